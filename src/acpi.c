@@ -0,0 +1,141 @@
+/* J. Kent Wirant
+ * osmium
+ * acpi.c
+ * Description: Locates the ACPI root tables and finds tables by
+ *   signature. Only static tables are read; there is no AML interpreter.
+ */
+
+//referenced https://wiki.osdev.org/RSDP
+//referenced https://wiki.osdev.org/RSDT
+
+#include "acpi.h"
+#include "paging.h"
+#include "string_util.h"
+
+#define BDA_EBDA_SEGMENT 0x0E //offset of the EBDA segment in the BIOS data area
+#define BIOS_AREA_START 0xE0000
+#define BIOS_AREA_END 0x100000
+#define ACPI_MAX_TABLES 32 //root table entries kept; QEMU has under 10
+
+struct Rsdp {
+	char signature[8]; //"RSD PTR "
+	uint8_t checksum; //first 20 bytes
+	char oemId[6];
+	uint8_t revision; //0 for ACPI 1.0, 2 or more for ACPI 2.0+
+	uint32_t rsdtAddress;
+	
+	//ACPI 2.0+
+	uint32_t length;
+	uint64_t xsdtAddress;
+	uint8_t extendedChecksum; //whole structure
+	uint8_t reserved[3];
+} __attribute__((packed));
+
+//volatile so GCC does not treat the fixed low address as a null-based
+//out-of-bounds access
+static volatile uint32_t biosDataArea = 0x400;
+
+//every table listed in the root table, mapped once by acpi_init since
+//mappings in the device window are never released. tables that could
+//not be mapped or have a bad checksum are left out.
+static const struct AcpiHeader *tables[ACPI_MAX_TABLES];
+static uint32_t tableCount = 0;
+
+static uint8_t checksum(const void *data, uint32_t length) {
+	const uint8_t *bytes = data;
+	uint8_t sum = 0;
+	
+	for(uint32_t i = 0; i < length; i++) {
+		sum += bytes[i];
+	}
+	
+	return sum;
+}
+
+static const struct Rsdp *scanForRsdp(uint32_t start, uint32_t end) {
+	//the RSDP is on a 16-byte boundary
+	for(uint32_t address = start; address + sizeof(struct Rsdp) <= end; address += 16) {
+		const struct Rsdp *rsdp = (const struct Rsdp *) address;
+		
+		if(strncmp(rsdp->signature, "RSD PTR ", 8) == 0 && checksum(rsdp, 20) == 0)
+			return rsdp;
+	}
+	
+	return 0;
+}
+
+//tables are usually in RAM below 3 GiB, which is identity mapped; others
+//are mapped into the device window
+static const struct AcpiHeader *mapTable(uint64_t address) {
+	const struct AcpiHeader *header;
+	
+	if(address + sizeof(struct AcpiHeader) <= PAGING_IDENTITY_END)
+		return (const struct AcpiHeader *)(uint32_t) address;
+	
+	if(address >> 32)
+		return 0;
+	
+	header = paging_mapDevice(address, sizeof(struct AcpiHeader), PAGING_CACHE_WRITE_BACK);
+	if(header == 0)
+		return 0;
+	
+	return paging_mapDevice(address, header->length, PAGING_CACHE_WRITE_BACK);
+}
+
+int acpi_init(void) {
+	uint32_t ebda = *(uint16_t *)(biosDataArea + BDA_EBDA_SEGMENT) << 4;
+	const struct Rsdp *rsdp = 0;
+	const struct AcpiHeader *table;
+	const uint8_t *entries;
+	uint32_t count;
+	uint64_t address;
+	int entrySize; //4 for the RSDT, 8 for the XSDT
+	
+	//first KiB of the EBDA, then the BIOS read-only area
+	if(ebda >= 0x80000 && ebda < BIOS_AREA_START)
+		rsdp = scanForRsdp(ebda, ebda + 1024);
+	if(rsdp == 0)
+		rsdp = scanForRsdp(BIOS_AREA_START, BIOS_AREA_END);
+	if(rsdp == 0)
+		return -1;
+	
+	if(rsdp->revision >= 2 && rsdp->xsdtAddress != 0 && 
+	  checksum(rsdp, rsdp->length) == 0) {
+		table = mapTable(rsdp->xsdtAddress);
+		entrySize = 8;
+	}
+	else {
+		table = mapTable(rsdp->rsdtAddress);
+		entrySize = 4;
+	}
+	
+	if(table == 0 || checksum(table, table->length) != 0)
+		return -1;
+	
+	entries = (const uint8_t *) table + sizeof(struct AcpiHeader);
+	count = (table->length - sizeof(struct AcpiHeader)) / entrySize;
+	tableCount = 0;
+	
+	for(uint32_t i = 0; i < count && tableCount < ACPI_MAX_TABLES; i++) {
+		const struct AcpiHeader *entry;
+		
+		address = *(const uint32_t *)(entries + i * entrySize);
+		if(entrySize == 8)
+			address |= (uint64_t) *(const uint32_t *)(entries + i * entrySize + 4) << 32;
+		
+		entry = mapTable(address);
+		if(entry && checksum(entry, entry->length) == 0)
+			tables[tableCount++] = entry;
+	}
+	
+	return 0;
+}
+
+const struct AcpiHeader *acpi_findTable(const char *signature) {
+	for(uint32_t i = 0; i < tableCount; i++) {
+		if(strncmp(tables[i]->signature, signature, 4) == 0)
+			return tables[i];
+	}
+	
+	return 0;
+}
@@ -0,0 +1,34 @@
+/* J. Kent Wirant
+ * osmium
+ * acpi.h
+ * Description: Locates the ACPI root tables and finds tables by
+ *   signature. Only static tables are read; there is no AML interpreter.
+ */
+
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+
+//common header of every system description table
+struct AcpiHeader {
+	char signature[4];
+	uint32_t length; //including this header
+	uint8_t revision;
+	uint8_t checksum;
+	char oemId[6];
+	char oemTableId[8];
+	uint32_t oemRevision;
+	uint32_t creatorId;
+	uint32_t creatorRevision;
+} __attribute__((packed));
+
+//finds the RSDP and the RSDT or XSDT; returns 0 on success or -1 if the
+//firmware has no (valid) ACPI tables. paging_init must be called first.
+int acpi_init(void);
+
+//returns the first table with the given 4-character signature whose
+//checksum is valid, or 0
+const struct AcpiHeader *acpi_findTable(const char *signature);
+
+#endif //ACPI_H
@@ -0,0 +1,245 @@
+/* J. Kent Wirant
+ * osmium
+ * apic.c
+ * Description: Local APIC and I/O APIC interrupt delivery, configured
+ *   from the ACPI MADT. Used through the pic_* functions in interrupts.h
+ *   when available.
+ */
+
+//referenced https://wiki.osdev.org/MADT
+//referenced https://wiki.osdev.org/IOAPIC
+
+#include "apic.h"
+#include "acpi.h"
+#include "paging.h"
+#include "x86_util.h"
+
+#define MSR_APIC_BASE 0x1B
+#define APIC_BASE_ENABLE 0x800
+
+#define CPUID_EDX_APIC (1UL << 9)
+
+//local APIC registers (byte offsets)
+#define LAPIC_ID 0x20
+#define LAPIC_TPR 0x80 //task priority
+#define LAPIC_EOI 0xB0
+#define LAPIC_SVR 0xF0 //spurious interrupt vector
+#define LAPIC_SVR_ENABLE 0x100
+
+//I/O APIC registers
+#define IOAPIC_REGSEL 0x00
+#define IOAPIC_WINDOW 0x10
+#define IOAPIC_VERSION 0x01
+#define IOAPIC_REDIRECTION 0x10 //two registers per input
+
+#define REDIRECTION_ACTIVE_LOW (1UL << 13)
+#define REDIRECTION_LEVEL (1UL << 15)
+#define REDIRECTION_MASKED (1UL << 16)
+
+//MADT entry types
+#define MADT_IOAPIC 1
+#define MADT_SOURCE_OVERRIDE 2
+#define MADT_LAPIC_ADDRESS 5
+
+//MPS INTI flags in source overrides
+#define MPS_POLARITY_MASK 0x03
+#define MPS_POLARITY_LOW 0x03
+#define MPS_TRIGGER_MASK 0x0C
+#define MPS_TRIGGER_LEVEL 0x0C
+
+#define MAX_IOAPICS 4
+#define ISA_IRQ_COUNT 16
+
+struct Madt {
+	struct AcpiHeader header;
+	uint32_t lapicAddress;
+	uint32_t flags;
+	uint8_t entries[]; //{type, length, ...} records
+} __attribute__((packed));
+
+struct IoApic {
+	volatile uint32_t *mmio;
+	uint32_t gsiBase; //first global system interrupt handled
+	uint32_t inputCount;
+};
+
+//ISA IRQ to global system interrupt mapping
+struct IrqRoute {
+	uint32_t gsi;
+	uint16_t flags; //MPS INTI flags; 0 means bus default
+	uint8_t overridden;
+};
+
+static volatile uint32_t *lapic = 0;
+static struct IoApic ioApics[MAX_IOAPICS];
+static int ioApicCount = 0;
+static struct IrqRoute isaRoutes[ISA_IRQ_COUNT];
+static uint8_t lapicId = 0;
+static int enabled = 0;
+
+static uint32_t lapicRead(uint32_t reg) {
+	return lapic[reg / 4];
+}
+
+static void lapicWrite(uint32_t reg, uint32_t value) {
+	lapic[reg / 4] = value;
+}
+
+static uint32_t ioApicRead(struct IoApic *ioApic, uint8_t reg) {
+	ioApic->mmio[IOAPIC_REGSEL / 4] = reg;
+	return ioApic->mmio[IOAPIC_WINDOW / 4];
+}
+
+static void ioApicWrite(struct IoApic *ioApic, uint8_t reg, uint32_t value) {
+	ioApic->mmio[IOAPIC_REGSEL / 4] = reg;
+	ioApic->mmio[IOAPIC_WINDOW / 4] = value;
+}
+
+static struct IoApic *findIoApic(uint32_t gsi) {
+	for(int i = 0; i < ioApicCount; i++) {
+		if(gsi >= ioApics[i].gsiBase && gsi < ioApics[i].gsiBase + ioApics[i].inputCount)
+			return &ioApics[i];
+	}
+	
+	return 0;
+}
+
+static void parseMadt(const struct Madt *madt, uint64_t *lapicAddress) {
+	const uint8_t *entry = madt->entries;
+	const uint8_t *end = (const uint8_t *) madt + madt->header.length;
+	
+	*lapicAddress = madt->lapicAddress;
+	
+	while(entry + 2 <= end && entry[1] >= 2 && entry + entry[1] <= end) {
+		if(entry[0] == MADT_IOAPIC && ioApicCount < MAX_IOAPICS) {
+			//id, reserved, address, GSI base
+			ioApics[ioApicCount].mmio = (volatile uint32_t *)(*(const uint32_t *)(entry + 4));
+			ioApics[ioApicCount].gsiBase = *(const uint32_t *)(entry + 8);
+			ioApicCount++;
+		}
+		else if(entry[0] == MADT_SOURCE_OVERRIDE && entry[2] == 0 && 
+		  entry[3] < ISA_IRQ_COUNT) {
+			//bus (0 = ISA), source IRQ, GSI, flags
+			isaRoutes[entry[3]].gsi = *(const uint32_t *)(entry + 4);
+			isaRoutes[entry[3]].flags = *(const uint16_t *)(entry + 8);
+			isaRoutes[entry[3]].overridden = 1;
+		}
+		else if(entry[0] == MADT_LAPIC_ADDRESS) {
+			*lapicAddress = *(const uint64_t *)(entry + 4);
+		}
+		
+		entry += entry[1];
+	}
+}
+
+int apic_init(void) {
+	const struct Madt *madt;
+	uint64_t lapicAddress;
+	uint32_t regs[4];
+	uint32_t lo, hi;
+	
+	x86_cpuid(1, regs);
+	if(!(regs[3] & CPUID_EDX_APIC))
+		return -1;
+	
+	madt = (const struct Madt *) acpi_findTable("APIC");
+	if(madt == 0)
+		return -1;
+	
+	//ISA IRQs map to the same GSI unless overridden
+	for(int i = 0; i < ISA_IRQ_COUNT; i++) {
+		isaRoutes[i].gsi = i;
+		isaRoutes[i].flags = 0;
+		isaRoutes[i].overridden = 0;
+	}
+	
+	ioApicCount = 0;
+	parseMadt(madt, &lapicAddress);
+	
+	if(ioApicCount == 0 || (lapicAddress >> 32))
+		return -1;
+	
+	//registers are uncached MMIO
+	lapic = paging_mapDevice(lapicAddress, PAGING_PAGE_SIZE, PAGING_CACHE_UNCACHED);
+	if(lapic == 0)
+		return -1;
+	
+	for(int i = 0; i < ioApicCount; i++) {
+		ioApics[i].mmio = paging_mapDevice((uint32_t) ioApics[i].mmio, 
+		  PAGING_PAGE_SIZE, PAGING_CACHE_UNCACHED);
+		if(ioApics[i].mmio == 0)
+			return -1;
+		
+		ioApics[i].inputCount = ((ioApicRead(&ioApics[i], IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+		
+		for(uint32_t j = 0; j < ioApics[i].inputCount; j++) {
+			ioApicWrite(&ioApics[i], IOAPIC_REDIRECTION + 2 * j, REDIRECTION_MASKED);
+		}
+	}
+	
+	//enable the local APIC (globally and in software) and accept all
+	//priorities
+	x86_readMSR(MSR_APIC_BASE, &lo, &hi);
+	x86_writeMSR(MSR_APIC_BASE, lo | APIC_BASE_ENABLE, hi);
+	lapicWrite(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+	lapicWrite(LAPIC_TPR, 0);
+	lapicId = lapicRead(LAPIC_ID) >> 24;
+	
+	enabled = 1;
+	return 0;
+}
+
+int apic_isEnabled(void) {
+	return enabled;
+}
+
+uint8_t apic_getId(void) {
+	return lapicId;
+}
+
+void apic_enableIrq(uint8_t irqLine, uint8_t vector, int activeLow, int levelTriggered) {
+	struct IrqRoute *route;
+	struct IoApic *ioApic;
+	uint32_t gsi = irqLine;
+	uint32_t entry = vector;
+	
+	if(irqLine < ISA_IRQ_COUNT) {
+		route = &isaRoutes[irqLine];
+		gsi = route->gsi;
+		
+		if(route->overridden) {
+			if((route->flags & MPS_POLARITY_MASK) != 0)
+				activeLow = (route->flags & MPS_POLARITY_MASK) == MPS_POLARITY_LOW;
+			if((route->flags & MPS_TRIGGER_MASK) != 0)
+				levelTriggered = (route->flags & MPS_TRIGGER_MASK) == MPS_TRIGGER_LEVEL;
+		}
+	}
+	
+	ioApic = findIoApic(gsi);
+	if(ioApic == 0)
+		return;
+	
+	//fixed delivery, physical destination
+	if(activeLow) entry |= REDIRECTION_ACTIVE_LOW;
+	if(levelTriggered) entry |= REDIRECTION_LEVEL;
+	
+	gsi -= ioApic->gsiBase;
+	ioApicWrite(ioApic, IOAPIC_REDIRECTION + 2 * gsi + 1, (uint32_t) lapicId << 24);
+	ioApicWrite(ioApic, IOAPIC_REDIRECTION + 2 * gsi, entry);
+}
+
+void apic_disableIrq(uint8_t irqLine) {
+	uint32_t gsi = (irqLine < ISA_IRQ_COUNT) ? isaRoutes[irqLine].gsi : irqLine;
+	struct IoApic *ioApic = findIoApic(gsi);
+	
+	if(ioApic == 0)
+		return;
+	
+	gsi -= ioApic->gsiBase;
+	ioApicWrite(ioApic, IOAPIC_REDIRECTION + 2 * gsi, 
+	  ioApicRead(ioApic, IOAPIC_REDIRECTION + 2 * gsi) | REDIRECTION_MASKED);
+}
+
+void apic_eoi(void) {
+	lapicWrite(LAPIC_EOI, 0);
+}
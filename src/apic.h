@@ -0,0 +1,35 @@
+/* J. Kent Wirant
+ * osmium
+ * apic.h
+ * Description: Local APIC and I/O APIC interrupt delivery, configured
+ *   from the ACPI MADT. Used through the pic_* functions in interrupts.h
+ *   when available.
+ */
+
+#ifndef APIC_H
+#define APIC_H
+
+#include <stdint.h>
+
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+//message signalled interrupts are memory writes to this window; bits
+//19-12 select the destination local APIC
+#define APIC_MSI_ADDRESS 0xFEE00000
+
+//finds the local APIC and I/O APICs in the MADT, enables the local APIC
+//and masks every I/O APIC input. returns 0 on success or -1 if there is
+//no usable APIC (nothing is changed in that case).
+int apic_init(void);
+int apic_isEnabled(void);
+uint8_t apic_getId(void); //this CPU's local APIC ID
+
+//routes ISA IRQ irqLine (after MADT source overrides) to vector, on this
+//CPU. activeLow/levelTriggered apply only if the MADT has no override.
+void apic_enableIrq(uint8_t irqLine, uint8_t vector, int activeLow, int levelTriggered);
+void apic_disableIrq(uint8_t irqLine);
+
+//signals end of interrupt with a single MMIO write
+void apic_eoi(void);
+
+#endif //APIC_H
@@ -5,20 +5,42 @@
 ; if needed, change macro values to troubleshoot
 %define INT_13H_EXT_SUPPORTED 1
 
-section .text
+; The kernel is read through a bounce buffer below 1 MiB, since the BIOS can
+; only write to real mode addresses. Chunks stay under the 0x7F sector limit
+; of some BIOSes and never cross a 64 KiB boundary.
+%define BOUNCE_SEGMENT	0x1000	; bounce buffer at linear address 0x10000
+%define BOUNCE_SECTORS	64		; sectors per chunk (32 KiB)
+
+; raw BIOS memory map (E820 entries of 24 bytes), handed to the kernel
+%define MEMORY_MAP_ADDR			0x1000
+%define MEMORY_MAP_MAX_ENTRIES	64
+
+; number of sectors occupied by this file (boot sector plus second stage);
+; the kernel image starts at the sector after these
+%define BOOT_SECTORS	((boot_end - boot_start) / 512)
+
+section .boot progbits alloc exec write align=16
 	global start_boot ; name of entry point
-	
+
+[extern _start]
+[extern _kernel_sectors]	; defined in linker.ld
+[extern _kernel_start]
+[extern _bss_start]
+[extern _kernel_end]
+
 bits 16
 ;org 0x7C00
 
 ; ======== MASTER BOOT RECORD (MBR) ===========================================
 ; The first 512 bytes of the boot drive are loaded into memory and executed.
-; This code/data (the MBR) must read and execute additional code from a disk 
-; drive. This is called the "second stage" of the bootloader. The BIOS 
+; This code/data (the MBR) must read and execute additional code from a disk
+; drive. This is called the "second stage" of the bootloader. The BIOS
 ; supports basic disk I/O operations and video display functions, which this
 ; source code utilizes for loading the second stage and for status reporting.
 ; =============================================================================
 
+boot_start:
+
 ; BIOS Parameter Block reserved space
 jmp start_boot
 times (3 - $ + $$) db 0x90
@@ -28,51 +50,44 @@ times 0x3B db 0x00
 start_boot:
 	; setup
 	cli 						; disable interrupts
-	mov [boot_drive_num], dl	; save boot drive
-	xor ax, ax					; set segment registers (except cs) to 0 
+	xor ax, ax					; set segment registers (except cs) to 0
 	mov ds, ax
 	mov es, ax
 	mov fs, ax
 	mov gs, ax
 	mov ss, ax
 	mov sp, 0x7A00				; set up stack (grows downward)
-	
+	mov [boot_drive_num], dl	; save boot drive (after DS is known)
+
 	; print boot message
 	mov si, str_boot
 	call print_str
-	
-%if INT_13H_EXT_SUPPORTED
+
+%if INT_13H_EXT_SUPPORTED == 0
+	; CHS addressing needs the drive geometry
+	call read_geometry
+%endif
+
 	; put default string at destination address of second sector (debugging)
 	mov si, str_stage2
 	mov dword [si], 0x00205820 ; " X "
-	
+
 	; load second stage into memory
-	mov ebx, 1 		; start from second sector (first is index 0)
-	mov cx, 60		; number of sectors to read
-	mov si, 0x7E00	; destination address
+	mov ebx, 1 					; start from second sector (first is index 0)
+	mov cx, BOOT_SECTORS - 1	; number of sectors to read
+	mov di, 0x7E00				; destination address (ES = 0)
 	mov dl, [boot_drive_num]
 	call read_disk
 
-%else	
-	; load second stage into memory (compatibility version)
-	mov al, 60		; number of sectors to read
-	mov bx, 0x7E00	; destination address
-	mov cx, 0x0002	; cylinder 0 and sector 2
-	mov dh, 0		; head number 0
-	mov dl, [boot_drive_num]
-	call read_disk_compat
-	
-%endif
-	
 	; print message and begin stage 2
 	mov si, str_stage2
 	call print_str
 	jmp stage2
-	
+
 	; halt the program (best practice)
 	cli
 	hlt
-	
+
 ; -----------------------------------------------------------------------------
 ; prints null-terminated string using BIOS.
 ; DS:SI - pointer to null-terminated string
@@ -85,7 +100,7 @@ print_str:
 	mov ah, 0x0E		; teletype output mode
 	xor bx, bx
 	jmp .load
-.loop:					; while char at DS:SI != 0, print char and continue 
+.loop:					; while char at DS:SI != 0, print char and continue
 	int 0x10
 .load:
 	lodsb
@@ -97,77 +112,134 @@ print_str:
 	pop ax
 	popf
 	ret
-	
+
 %if INT_13H_EXT_SUPPORTED
 ; -----------------------------------------------------------------------------
 ; Reads a specified number of 512-byte disk sectors into memory.
 ; EBX - LBA of first sector to read
-; CX - number of sectors to read (maximum might be 0x79)
+; CX - number of sectors to read (maximum might be 0x7F)
 ; DL - drive number (e.g. 1st HDD is 0x80)
-; DS:SI - address to write to
+; ES:DI - address to write to
 ; https://en.wikipedia.org/wiki/INT_13H#INT_13h_AH=42h:_Extended_Read_Sectors_From_Drive
 read_disk:
 	pushf
-	pusha
-	
-	; populate disk address packet
+	pushad				; some BIOSes clobber the upper halves of registers
+
+	; populate disk address packet (DS = 0)
 	mov [disk_address_packet_len], cx
-	mov [disk_address_packet_mem], si ; note: this has two 16-bit fields (seg. and offs.)
-	mov [disk_address_packet_mem + 2], ds
+	mov [disk_address_packet_mem], di ; note: this has two 16-bit fields (offs. and seg.)
+	mov [disk_address_packet_mem + 2], es
 	mov [disk_address_packet_lba], ebx
-	
+
 	; load interrupt arguments
-	xor ax, ax
-	mov ds, ax
 	mov si, disk_address_packet
 	mov ah, 0x42 	; Function number for Extended Read Sectors from Drive
 	int 0x13		; call BIOS to read disk sectors into memory
-	
+
 	; if no error, exit function, otherwise print error message and hang
 	jnc .success
 	mov si, str_err_read
 	call print_str
 	cli
 	hlt
-	
+
 .success:
-	popa
+	popad
 	popf
 	ret
 
 %else
 ; -----------------------------------------------------------------------------
-; Reads a specified number of 512-byte disk sectors into memory.
-; NOTE: A sector number of 0 is invalid; i.e. allowed values are 1-63.
-; AL - number of sectors to read
-; CL - cylinder number (bits 0-7)
-; CH - sector number (bits 0-5) and cylinder number (bits 8-9, mapped to 6-7)
+; Reads a specified number of 512-byte disk sectors into memory using CHS
+; addressing. Sectors are read one at a time so a read never crosses a track.
+; EBX - LBA of first sector to read
+; CX - number of sectors to read
 ; DL - drive number (e.g. 1st HDD is 0x80)
-; DH - head number
-; ES:BX - address to write to
+; ES:DI - address to write to (DI must be a multiple of 16)
 ; https://en.wikipedia.org/wiki/INT_13H#INT_13h_AH=02h:_Read_Sectors_From_Drive
-read_disk_compat:
+read_disk:
 	pushf
-	push ax
-	
-	mov ah, 0x02 	; Function number for Read Sectors from Drive
-	int 0x13		; call BIOS to read disk sectors into memory
-	
-	; if no error, exit function, otherwise print error message and hang
+	pushad
+	push es
+
+	; step through memory by segment so the offset never wraps
+	mov ax, di
+	shr ax, 4
+	mov si, es
+	add si, ax
+	mov es, si
+	mov [disk_chs_drive], dl
+
+.next:
+	push cx
+
+	; LBA to CHS: sector = LBA % SPT + 1, head = (LBA / SPT) % heads,
+	; cylinder = LBA / SPT / heads
+	mov eax, ebx
+	xor edx, edx
+	movzx ecx, word [disk_sectors_per_track]
+	div ecx
+	mov si, dx
+	inc si					; sector numbers start at 1
+	xor edx, edx
+	movzx ecx, word [disk_heads]
+	div ecx					; EAX = cylinder, EDX = head
+
+	mov ch, al				; CH - cylinder number (bits 0-7)
+	mov cl, ah
+	shl cl, 6				; CL - cylinder bits 8-9 in bits 6-7
+	mov ax, si
+	or cl, al				; CL - sector number in bits 0-5
+	mov dh, dl				; DH - head number
+	mov dl, [disk_chs_drive]
+
+	push bx
+	xor bx, bx				; ES:BX - address to write to
+	mov ax, 0x0201 			; Function number for Read Sectors from Drive (1 sector)
+	int 0x13				; call BIOS to read disk sectors into memory
+	pop bx
+
+	; if no error, continue, otherwise print error message and hang
 	jnc .success
 	mov si, str_err_read
 	call print_str
 	cli
 	hlt
-	
+
 .success:
-	pop ax
+	mov ax, es				; advance by one sector
+	add ax, 512 / 16
+	mov es, ax
+	inc ebx
+	pop cx
+	loop .next
+
+	pop es
+	popad
 	popf
 	ret
-	
+
+; -----------------------------------------------------------------------------
+; Gets the number of heads and sectors per track of the boot drive.
+; https://en.wikipedia.org/wiki/INT_13H#INT_13h_AH=08h:_Read_Drive_Parameters
+read_geometry:
+	pushad
+	push es
+	mov ah, 0x08
+	mov dl, [boot_drive_num]
+	int 0x13
+	and cx, 0x3F				; sectors per track (bits 0-5)
+	mov [disk_sectors_per_track], cx
+	movzx dx, dh				; maximum head index
+	inc dx
+	mov [disk_heads], dx
+	pop es
+	popad
+	ret
+
 %endif
-	
-	
+
+
 ; DATA AND VARIABLES ----------------------------------------------------------
 
 str_boot:					db 'Booting OS...', 13, 10, 0
@@ -180,6 +252,10 @@ disk_address_packet: 		db 0x10, 0		; size of DAP followed by 0
 disk_address_packet_len:	dw 0			; number of sectors to read
 disk_address_packet_mem:	dd 0			; destination address of read
 disk_address_packet_lba:	dq 0			; logical block address
+%else
+disk_sectors_per_track:		dw 0
+disk_heads:					dw 0
+disk_chs_drive:				db 0
 %endif
 
 ; PARTITION TABLE--------------------------------------------------------------
@@ -197,16 +273,26 @@ dw 0xAA55 ; signature of bootable drive
 ; The MBR calls upon the BIOS to load this part into memory. The second stage
 ; of the bootloader must set up the execution environment for the operating
 ; system, then transition from 16-bit Real Mode into 32-bit Protected Mode.
-; Setting up the execution environment may include using the BIOS to create
-; a map of the address space, collecting information regarding the PCI bus,
-; and others, but much of this is outside the scope of this project. 
-; Transitioning from Real Mode to Protected Mode requires setting up a 
+; Setting up the execution environment includes using the BIOS to create
+; a map of the address space; other information, such as the PCI bus
+; configuration, is gathered later by the kernel itself.
+; Transitioning from Real Mode to Protected Mode requires setting up a
 ; Global Descriptor Table (GDT) to describe the 32-bit memory space. This
 ; implementation uses the Flat Memory Model, where the whole address space
 ; is readable, writable, and executable from the kernel and user space.
+;
+; The kernel itself is linked to run at 1 MiB (see linker.ld). The second
+; stage enables the A20 line, then reads the kernel in chunks into a bounce
+; buffer and copies each chunk above 1 MiB from "unreal mode". The number of
+; sectors to read comes from the kernel header below, which the linker fills
+; in, so the kernel can grow without changes to this file.
 ; =============================================================================
 
 stage2:
+	call enable_a20
+	call read_memory_map
+	call load_kernel
+
 	cli
 	lgdt [gdt_descriptor]	; load global descriptor table
 	mov eax, cr0
@@ -215,8 +301,280 @@ stage2:
 	jmp (gdt_kernel_code - gdt_null):proc_pmode_start ; far jump to 32-bit code
 	hlt
 
+; -----------------------------------------------------------------------------
+; Enables the A20 line so that addresses above 1 MiB do not wrap around.
+; Nothing is done if it is already enabled, which is the usual case, so the
+; check is all most machines pay for. Otherwise the "fast A20" gate at port
+; 0x92 is tried first, then the keyboard controller, then the BIOS.
+; https://wiki.osdev.org/A20_Line
+enable_a20:
+	call check_a20
+	jnz .done
+
+	in al, 0x92				; fast A20: set bit 1; bit 0 would reset the CPU
+	test al, 0x02
+	jnz .kbc				; already set but not working: try something else
+	or al, 0x02
+	and al, 0xFE
+	out 0x92, al
+	call check_a20
+	jnz .done
+
+.kbc:
+	call enable_a20_kbc
+	call check_a20
+	jnz .done
+
+	mov ax, 0x2401			; BIOS: enable A20 gate
+	int 0x15
+	call check_a20
+	jnz .done
+
+	mov si, str_err_a20
+	call print_str
+	cli
+	hlt
+
+.done:
+	ret
+
+; -----------------------------------------------------------------------------
+; Sets the A20 gate bit (bit 1) of the 8042 keyboard controller's output
+; port. The keyboard is disabled meanwhile so a key press cannot be read as
+; the port value. The gate can take a while to follow, so the wraparound
+; check is repeated a bounded number of times.
+enable_a20_kbc:
+	push ax
+	push cx
+
+	call kbc_wait_write
+	mov al, 0xAD			; disable keyboard
+	out 0x64, al
+	call kbc_wait_write
+	mov al, 0xD0			; read output port
+	out 0x64, al
+	call kbc_wait_read
+	in al, 0x60
+	mov ah, al
+
+	call kbc_wait_write
+	mov al, 0xD1			; write output port
+	out 0x64, al
+	call kbc_wait_write
+	mov al, ah
+	or al, 0x02
+	out 0x60, al
+
+	call kbc_wait_write
+	mov al, 0xAE			; enable keyboard
+	out 0x64, al
+	call kbc_wait_write
+
+	mov cx, 0x1000
+.wait:
+	call check_a20
+	jnz .end
+	loop .wait
+
+.end:
+	pop cx
+	pop ax
+	ret
+
+; Waits until the 8042 can accept a byte (input buffer empty). Gives up after
+; 64K status reads so a machine without a controller does not hang. Uses AL.
+kbc_wait_write:
+	push cx
+	mov cx, 0xFFFF
+.loop:
+	in al, 0x64
+	test al, 0x02
+	jz .end
+	loop .loop
+.end:
+	pop cx
+	ret
+
+; Waits until the 8042 has a byte to read (output buffer full). Uses AL.
+kbc_wait_read:
+	push cx
+	mov cx, 0xFFFF
+.loop:
+	in al, 0x64
+	test al, 0x01
+	jnz .end
+	loop .loop
+.end:
+	pop cx
+	ret
+
+; -----------------------------------------------------------------------------
+; Clears ZF if the A20 line is enabled, sets ZF if it is disabled. The boot
+; signature at 0000:7DFE is compared with the same address 1 MiB higher
+; (FFFF:7E0E), which is an alias of it while A20 is disabled.
+check_a20:
+	push ax
+	push es
+	mov ax, 0xFFFF
+	mov es, ax
+
+	mov ax, [es:0x7E0E]
+	cmp ax, [0x7DFE]
+	jne .end				; different values: no wraparound
+
+	not word [0x7DFE]		; equal values might be a coincidence; change one
+	mov ax, [es:0x7E0E]
+	cmp ax, [0x7DFE]
+	not word [0x7DFE]		; restore signature (NOT does not change flags)
+
+.end:
+	pop es
+	pop ax
+	ret
+
+; -----------------------------------------------------------------------------
+; Stores the BIOS memory map (INT 15h, EAX=E820h) at MEMORY_MAP_ADDR and the
+; number of entries in boot_info. Entries are kept in the order the BIOS
+; reports them; the kernel sorts and merges them (see memory_map.c).
+; https://wiki.osdev.org/Detecting_Memory_(x86)#BIOS_Function:_INT_0x15.2C_EAX_.3D_0xE820
+read_memory_map:
+	pushad
+	xor bp, bp					; number of entries stored
+	mov di, MEMORY_MAP_ADDR		; ES:DI - next entry (ES = 0)
+	xor ebx, ebx				; continuation value; 0 to start
+
+.next:
+	mov dword [di + 20], 1		; "valid" in case the BIOS only writes 20 bytes
+	mov eax, 0xE820
+	mov edx, 0x534D4150			; 'SMAP'
+	mov ecx, 24
+	int 0x15
+	jc .end						; unsupported, or past the last entry
+	cmp eax, 0x534D4150
+	jne .end
+
+	mov eax, [di + 8]			; skip entries of length 0
+	or eax, [di + 12]
+	jz .skip
+	test byte [di + 20], 1		; skip entries marked "ignore" (ACPI 3.0)
+	jz .skip
+
+	add di, 24
+	inc bp
+	cmp bp, MEMORY_MAP_MAX_ENTRIES
+	jae .end
+
+.skip:
+	test ebx, ebx				; 0 after the last entry
+	jnz .next
+
+.end:
+	mov [boot_info_memory_map_count], bp
+	popad
+	ret
+
+; -----------------------------------------------------------------------------
+; Reads the kernel image (the sectors after the boot code) in chunks through
+; the bounce buffer and copies each chunk to the kernel's load address.
+load_kernel:
+	mov ebx, BOOT_SECTORS				; LBA of the first kernel sector
+	mov edi, [kernel_load_addr]			; destination of the next chunk
+	mov ebp, [kernel_sectors]			; sectors left to read
+
+.next_chunk:
+	test ebp, ebp
+	jz .done
+
+	mov ecx, ebp
+	cmp ecx, BOUNCE_SECTORS
+	jbe .read
+	mov ecx, BOUNCE_SECTORS
+
+.read:
+	push edi
+	mov ax, BOUNCE_SEGMENT
+	mov es, ax
+	xor di, di
+	mov dl, [boot_drive_num]
+	call read_disk
+	xor ax, ax
+	mov es, ax
+	pop edi
+
+	; copy chunk to its destination (ECX * 128 doublewords)
+	call enter_unreal
+	push ecx
+	shl ecx, 7
+	mov esi, BOUNCE_SEGMENT << 4
+
+.copy:
+	mov eax, [fs:esi]
+	mov [fs:edi], eax
+	add esi, 4
+	add edi, 4
+	dec ecx
+	jnz .copy
+
+	pop ecx
+	add ebx, ecx
+	sub ebp, ecx
+
+	mov si, str_progress	; one dot per chunk
+	call print_str
+	jmp .next_chunk
+
+.done:
+	mov si, str_newline
+	call print_str
+	ret
+
+; -----------------------------------------------------------------------------
+; Loads FS with the 4 GiB kernel data segment, then returns to Real Mode. FS
+; keeps the 4 GiB limit ("unreal mode"), so [fs:edi] can reach memory above
+; 1 MiB. This is done before every copy, since a BIOS call may reload FS.
+enter_unreal:
+	pushf
+	push eax
+	push bx
+	cli
+	lgdt [gdt_descriptor]
+	mov eax, cr0
+	or al, 1					; enter Protected Mode
+	mov cr0, eax
+	jmp short $ + 2
+	mov bx, (gdt_kernel_data - gdt_null)
+	mov fs, bx
+	and al, 0xFE				; back to Real Mode
+	mov cr0, eax
+	jmp short $ + 2
+	xor bx, bx					; base 0; the cached 4 GiB limit stays
+	mov fs, bx
+	pop bx
+	pop eax
+	popf
+	ret
+
 ; DATA AND VARIABLES ----------------------------------------------------------
 str_stage2:					db 'Second stage loaded.', 13, 10, 0
+str_err_a20:				db 'Could not enable A20.', 13, 10, 0
+str_progress:				db '.', 0
+str_newline:				db 13, 10, 0
+
+; BOOT INFORMATION ------------------------------------------------------------
+; Passed to _start; must match struct BootInfo in boot_info.h.
+
+align 4
+boot_info:
+boot_info_memory_map:		dd MEMORY_MAP_ADDR
+boot_info_memory_map_count:	dd 0
+
+; KERNEL HEADER ---------------------------------------------------------------
+; These values are filled in at link time from symbols defined in linker.ld.
+
+align 4
+kernel_header:
+kernel_sectors:				dd _kernel_sectors	; sectors after the boot code
+kernel_load_addr:			dd _kernel_start	; where the kernel runs (>= 1 MiB)
 
 ; GLOBAL DESCRIPTOR TABLE -----------------------------------------------------
 ; https://wiki.osdev.org/Global_Descriptor_Table
@@ -225,7 +583,7 @@ align 8 ; gdt must be on 8-byte boundary (for descriptor may be unnecessary)
 gdt_descriptor:
 	dw (gdt_end - gdt_null - 1) ; size
 	dd gdt_null ; offset
-	
+
 align 8 ; gdt must be on 8-byte boundary
 gdt_null:			dq 0
 gdt_kernel_code:	dq 0x00CF9A000000FFFF ; 4 GiB range, ring 0, readable code
@@ -235,13 +593,12 @@ gdt_user_data:		dq 0x00CFF2000000FFFF ; 4 GiB range, ring 3, writable data
 gdt_end:
 
 ; ======== PROTECTED MODE =====================================================
-; This part of the bootloader runs in 32-bit Protected Mode. It hands over 
+; This part of the bootloader runs in 32-bit Protected Mode. It hands over
 ; control to the cross-compiled C code. Developing the operating system in C
 ; is more productive and less error-prone than developing in assembly language.
 ; =============================================================================
 
 [bits 32]
-[extern _start]
 
 ; -----------------------------------------------------------------------------
 proc_pmode_start:
@@ -252,7 +609,7 @@ proc_pmode_start:
 	mov fs, ax
 	mov gs, ax
 	mov esp, 0x7C00 ; stack just below boot sector
-	
+
 	; print message by writing to video memory (white text, black background)
 	; odd byte addresses are color format, even byte addresses are ASCII
 	mov ebx, 0xB8000 ; video memory address
@@ -268,10 +625,24 @@ proc_pmode_start:
 	mov dword [ebx+356], 0x0F6F0F4D ; "Mo"
 	mov dword [ebx+360], 0x0F650F64 ; "de"
 	mov dword [ebx+364], 0x0F200F2E ; ". " ("Entered Protected Mode. ")
-	
-	sti ; enable interrupts
-	jmp _start ; begin C code
+
+	; .bss is not stored in the image, so it must be cleared here
+	cld
+	mov edi, _bss_start
+	mov ecx, _kernel_end
+	sub ecx, edi
+	shr ecx, 2 ; both are 4-byte aligned (see linker.ld)
+	xor eax, eax
+	rep stosd
+
+	cli ; the BIOS IVT is still in IDTR; _start enables interrupts itself
+	push boot_info
+	call _start ; begin C code
+	cli
 	hlt
-	
+
 ; -----------------------------------------------------------------------------
-	
\ No newline at end of file
+
+; pad to a whole number of sectors; the kernel image starts at the next one
+times (512 - ($ - $$) % 512) % 512 db 0
+boot_end:
@@ -0,0 +1,19 @@
+/* J. Kent Wirant
+ * osmium
+ * boot_info.h
+ * Description: Information collected by the bootloader (boot.asm) and
+ *   passed to _start.
+ */
+
+#ifndef BOOT_INFO_H
+#define BOOT_INFO_H
+
+#include <stdint.h>
+
+//must match the layout of boot_info in boot.asm
+struct BootInfo {
+	uint32_t memoryMap;      //address of the raw E820 entries
+	uint32_t memoryMapCount; //number of entries; 0 if E820 is unsupported
+};
+
+#endif //BOOT_INFO_H
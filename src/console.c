@@ -0,0 +1,86 @@
+/* J. Kent Wirant
+ * osmium
+ * console.c
+ * Description: Console multiplexer. Shell output is mirrored to the
+ *   serial port, and lines typed on the serial port are handed to the
+ *   shell like commands typed on the keyboard.
+ */
+
+#include "console.h"
+#include "serial.h"
+
+static void (*handler)(const char *line) = 0;
+static char line[CONSOLE_LINE_LENGTH + 1];
+static uint32_t lineLength = 0;
+static int lastWasCr = 0; //"\r\n" ends one line, not two
+
+void console_init(void (*lineHandler)(const char *line)) {
+	handler = lineHandler;
+	lineLength = 0;
+	console_write("\nosmium serial console\n> ");
+}
+
+void console_writeN(const char *str, uint32_t length) {
+	uint32_t start = 0;
+	
+	for(uint32_t i = 0; i < length; i++) {
+		if(str[i] == '\n') {
+			serial_send(&str[start], i - start);
+			serial_send("\r\n", 2);
+			start = i + 1;
+		}
+	}
+	
+	serial_send(&str[start], length - start);
+}
+
+void console_write(const char *str) {
+	uint32_t length = 0;
+	
+	while(str[length]) {
+		length++;
+	}
+	
+	console_writeN(str, length);
+}
+
+uint32_t console_processInput(void) {
+	uint8_t batch[16];
+	uint32_t count;
+	uint32_t lines = 0;
+	char c;
+	
+	while((count = serial_receive(batch, sizeof(batch))) > 0) {
+		for(uint32_t i = 0; i < count; i++) {
+			c = batch[i];
+			
+			if(c == '\n' && lastWasCr) {
+				lastWasCr = 0;
+				continue;
+			}
+			
+			lastWasCr = (c == '\r');
+			
+			if(c == '\r' || c == '\n') {
+				line[lineLength] = 0;
+				console_write("\n");
+				if(handler) handler(line);
+				console_write("> ");
+				lineLength = 0;
+				lines++;
+			}
+			else if(c == '\b' || c == 0x7F) { //backspace or delete
+				if(lineLength > 0) {
+					lineLength--;
+					console_write("\b \b");
+				}
+			}
+			else if(c >= 0x20 && c < 0x7F && lineLength < CONSOLE_LINE_LENGTH) {
+				line[lineLength++] = c;
+				console_writeN(&c, 1);
+			}
+		}
+	}
+	
+	return lines;
+}
@@ -0,0 +1,29 @@
+/* J. Kent Wirant
+ * osmium
+ * console.h
+ * Description: Console multiplexer. Shell output is mirrored to the
+ *   serial port, and lines typed on the serial port are handed to the
+ *   shell like commands typed on the keyboard.
+ */
+
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdint.h>
+
+#define CONSOLE_LINE_LENGTH 32 //same as the shell's command buffer
+
+//lineHandler receives each complete line (without the line ending,
+//null-terminated)
+void console_init(void (*lineHandler)(const char *line));
+
+//reads pending serial input, echoing it; returns the number of lines
+//handled
+uint32_t console_processInput(void);
+
+//writes to the serial side without waiting; output that does not fit in
+//the transmit ring is dropped. "\n" is sent as "\r\n".
+void console_write(const char *str);
+void console_writeN(const char *str, uint32_t length);
+
+#endif //CONSOLE_H
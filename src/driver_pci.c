@@ -7,56 +7,725 @@
 
 #include "driver_pci.h"
 #include "x86_util.h"
+#include "acpi.h"
+#include "paging.h"
+#include "heap.h"
+#include "apic.h"
+#include "interrupts.h"
+#include "isr.h"
+
+#define PCI_MAX_FUNCTIONS 256
+#define PCI_HASH_BITS 6 //64 buckets per index
 
 void pciReadTable(uint8_t bus, uint8_t device, uint8_t function, struct PCI_TABLE *table) {
 	for(int i = 0; i < 64; i++) {
-		((uint32_t *) table)[i] = pciConfigReadInt32(bus, device, function, 0);
+		((uint32_t *) table)[i] = pciConfigReadInt32(bus, device, function, i * 4);
+	}
+}
+
+//referenced https://wiki.osdev.org/PCI_Express
+//one MCFG allocation: ECAM base address for a range of buses
+struct McfgEntry {
+	uint64_t baseAddress;
+	uint16_t segment;
+	uint8_t startBus;
+	uint8_t endBus;
+	uint32_t reserved;
+} __attribute__((packed));
+
+struct Mcfg {
+	struct AcpiHeader header;
+	uint64_t reserved;
+	struct McfgEntry entries[];
+} __attribute__((packed));
+
+//each function has 4 KiB of configuration space: bus << 20 | device << 15
+//| function << 12. only segment 0 is used.
+static volatile uint8_t *ecam = 0; //mapped address of bus ecamStartBus
+static uint8_t ecamStartBus = 0;
+static uint8_t ecamEndBus = 0;
+static uint8_t accessMethod = PCI_ACCESS_LEGACY;
+
+uint8_t pciInit(void) {
+	const struct Mcfg *mcfg = (const struct Mcfg *) acpi_findTable("MCFG");
+	const struct McfgEntry *entry;
+	uint32_t count;
+	uint32_t size;
+	
+	accessMethod = PCI_ACCESS_LEGACY;
+	if(mcfg == 0)
+		return accessMethod;
+	
+	count = (mcfg->header.length - sizeof(struct Mcfg)) / sizeof(struct McfgEntry);
+	
+	for(uint32_t i = 0; i < count; i++) {
+		entry = &mcfg->entries[i];
+		
+		//without PAE, only regions below 4 GiB can be mapped
+		if(entry->segment != 0 || entry->startBus > entry->endBus ||
+		  (entry->baseAddress >> 32) != 0)
+			continue;
+		
+		//config space has side effects, so it must not be cached
+		size = (uint32_t)(entry->endBus - entry->startBus + 1) << 20;
+		ecam = paging_mapDevice((uint32_t) entry->baseAddress + 
+		  ((uint32_t) entry->startBus << 20), size, PAGING_CACHE_UNCACHED);
+		
+		if(ecam != 0) {
+			ecamStartBus = entry->startBus;
+			ecamEndBus = entry->endBus;
+			accessMethod = PCI_ACCESS_ECAM;
+			break;
+		}
 	}
+	
+	return accessMethod;
+}
+
+uint8_t pciGetAccessMethod(void) {
+	return accessMethod;
 }
 
-uint32_t pciConfigReadInt32(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset) {
+int pciSetAccessMethod(uint8_t method) {
+	if(method == PCI_ACCESS_ECAM && ecam == 0)
+		return -1;
+	
+	accessMethod = method;
+	return 0;
+}
+
+//returns the mapped address of a register, or 0 if ECAM cannot reach it
+static volatile uint8_t *ecamAddress(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset) {
+	if(accessMethod != PCI_ACCESS_ECAM || bus < ecamStartBus || bus > ecamEndBus)
+		return 0;
+	
+	return ecam + ((uint32_t)(bus - ecamStartBus) << 20 | (uint32_t)(device & 0x1F) << 15 |
+	  (uint32_t)(function & 0x07) << 12 | (offset & (PCI_EXTENDED_CONFIG_SPACE_SIZE - 1)));
+}
+
+//selects a dword with 0xCF8 and returns the data port for offset within it.
+//interrupts are disabled by the caller so nothing can reselect in between.
+static uint16_t legacySelect(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset) {
 	uint32_t ldevice = device & 0x1F; //device is 5 bits
 	uint32_t lfunction = function & 0x07; //function is 3 bits
-	uint32_t loffset = offset & ~(0x03); //lower two bits of offset should be 0
-	uint32_t address = (1UL << 31 | bus << 16 | device << 11 | function << 8 | offset);
+	uint32_t loffset = offset & 0xFC; //lower two bits of offset should be 0
+	uint32_t address = (1UL << 31 | (uint32_t) bus << 16 | ldevice << 11 | lfunction << 8 | loffset);
 	x86_outd((uint16_t) PCI_REG_CFIG_ADDR, address);
-	return x86_ind((uint16_t) PCI_REG_CFIG_DATA);
+	return PCI_REG_CFIG_DATA + (offset & 3);
+}
+
+uint32_t pciConfigReadInt32(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset) {
+	volatile uint8_t *reg = ecamAddress(bus, device, function, offset & ~3);
+	uint32_t flags;
+	uint32_t value;
+	
+	if(reg != 0)
+		return *(volatile uint32_t *) reg;
+	if(offset >= PCI_CONFIG_SPACE_SIZE)
+		return 0xFFFFFFFF;
+	
+	flags = x86_disableInterrupts();
+	value = x86_ind(legacySelect(bus, device, function, offset & ~3));
+	x86_restoreInterrupts(flags);
+	return value;
+}
+
+//narrow reads touch only the bytes asked for, by MMIO or by reading the
+//data port at the byte's position
+uint16_t pciConfigReadInt16(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset) {
+	volatile uint8_t *reg = ecamAddress(bus, device, function, offset & ~1);
+	uint32_t flags;
+	uint16_t value;
+	
+	if(reg != 0)
+		return *(volatile uint16_t *) reg;
+	if(offset >= PCI_CONFIG_SPACE_SIZE)
+		return 0xFFFF;
+	
+	flags = x86_disableInterrupts();
+	value = x86_inw(legacySelect(bus, device, function, offset & ~1));
+	x86_restoreInterrupts(flags);
+	return value;
+}
+
+uint8_t pciConfigReadInt8(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset) {
+	volatile uint8_t *reg = ecamAddress(bus, device, function, offset);
+	uint32_t flags;
+	uint8_t value;
+	
+	if(reg != 0)
+		return *reg;
+	if(offset >= PCI_CONFIG_SPACE_SIZE)
+		return 0xFF;
+	
+	flags = x86_disableInterrupts();
+	value = x86_inb(legacySelect(bus, device, function, offset));
+	x86_restoreInterrupts(flags);
+	return value;
+}
+
+void pciConfigWriteInt32(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint32_t value) {
+	volatile uint8_t *reg = ecamAddress(bus, device, function, offset & ~3);
+	uint32_t flags;
+	
+	if(reg != 0) {
+		*(volatile uint32_t *) reg = value;
+	}
+	else if(offset < PCI_CONFIG_SPACE_SIZE) {
+		flags = x86_disableInterrupts();
+		x86_outd(legacySelect(bus, device, function, offset & ~3), value);
+		x86_restoreInterrupts(flags);
+	}
 }
 
-uint16_t pciConfigReadInt16(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset) {
-	return pciConfigReadInt32(bus, device, function, offset) >> (8 * (offset & 2)) & 0xFFFF;
+void pciConfigWriteInt16(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint16_t value) {
+	volatile uint8_t *reg = ecamAddress(bus, device, function, offset & ~1);
+	uint32_t flags;
+	
+	if(reg != 0) {
+		*(volatile uint16_t *) reg = value;
+	}
+	else if(offset < PCI_CONFIG_SPACE_SIZE) {
+		flags = x86_disableInterrupts();
+		x86_outw(legacySelect(bus, device, function, offset & ~1), value);
+		x86_restoreInterrupts(flags);
+	}
 }
 
-uint8_t pciConfigReadInt8(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset) {
-	return pciConfigReadInt32(bus, device, function, offset) >> (8 * (offset & 3)) & 0xFF;
+void pciConfigWriteInt8(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint8_t value) {
+	volatile uint8_t *reg = ecamAddress(bus, device, function, offset);
+	uint32_t flags;
+	
+	if(reg != 0) {
+		*reg = value;
+	}
+	else if(offset < PCI_CONFIG_SPACE_SIZE) {
+		flags = x86_disableInterrupts();
+		x86_outb(legacySelect(bus, device, function, offset), value);
+		x86_restoreInterrupts(flags);
+	}
 }
 
 bool pciDeviceExists(uint8_t bus, uint8_t device, uint8_t function) {
 	return pciConfigReadInt16(bus, device, function, PCI_HDR_VENDOR_ID) != 0xFFFF;
 }
 
+//referenced https://wiki.osdev.org/PCI#Recursive_Scan
+//the scan follows the bus numbers the firmware gave each bridge instead
+//of probing all 256 buses, so it costs 32 reads per bus that exists plus
+//a few per function found
+struct PciScan {
+	uint16_t *functionList;
+	uint16_t max;
+	uint16_t count;
+	uint32_t scannedBuses[256 / 32]; //guards against misconfigured bridges
+};
+
+static void scanBus(struct PciScan *scan, uint8_t bus);
+
+//returns false once the list is full
+static bool addFunction(struct PciScan *scan, uint8_t bus, uint8_t dev, uint8_t fn) {
+	if(scan->count >= scan->max)
+		return false;
+	
+	scan->functionList[scan->count++] = bus << 8 | dev << 3 | fn;
+	
+	//PCI-to-PCI bridge: the buses behind it are secondary..subordinate
+	if(pciConfigReadInt16(bus, dev, fn, PCI_HDR_SUBCLASS) == 0x0604 &&
+	  (pciConfigReadInt8(bus, dev, fn, PCI_HDR_HEADER_TYPE) & 0x7F) == 1) {
+		uint8_t secondary = pciConfigReadInt8(bus, dev, fn, PCI_HDR1_SECONDARY_BUS_NUMBER);
+		uint8_t subordinate = pciConfigReadInt8(bus, dev, fn, PCI_HDR1_SUBORDINATE_BUS_NUMBER);
+		
+		//bus 0 means the bridge was never assigned buses
+		if(secondary > bus && secondary <= subordinate)
+			scanBus(scan, secondary);
+	}
+	
+	return scan->count < scan->max;
+}
+
+static void scanBus(struct PciScan *scan, uint8_t bus) {
+	if(scan->scannedBuses[bus / 32] & (1UL << (bus % 32)))
+		return;
+	scan->scannedBuses[bus / 32] |= 1UL << (bus % 32);
+	
+	for(int dev = 0; dev < 32; dev++) {
+		if(!pciDeviceExists(bus, dev, 0))
+			continue;
+		
+		if(!addFunction(scan, bus, dev, 0))
+			return;
+		
+		if((pciConfigReadInt8(bus, dev, 0, PCI_HDR_HEADER_TYPE) & 0x80) != 0) {
+			for(int fn = 1; fn < 8; fn++) {
+				if(pciDeviceExists(bus, dev, fn) && !addFunction(scan, bus, dev, fn))
+					return;
+			}
+		}
+	}
+}
+
+//stores up to max functions as bus << 8 | device << 3 | function, each
+//bridge followed by the functions behind it, and returns the count
 uint16_t pciEnumerate(uint16_t *functionList, uint16_t max) {
-    uint16_t count = 0;
-
-    for(int bus = 0; bus < 256; bus++) {
-        for(int dev = 0; dev < 32; dev++) {
-            if(pciDeviceExists(bus, dev, 0)) {
-                functionList[count] = bus << 8 | dev << 3;
-                count++;
-                if(count >= max) return count;
-            
-                if((pciConfigReadInt8(bus, dev, 0, PCI_HDR_HEADER_TYPE) & 0x80) != 0) {
-                    for(int fn = 1; fn < 8; fn++) {
-                        if(pciDeviceExists(bus, dev, fn)) {
-                            functionList[count] = bus << 8 | dev << 3 | fn;
-                            count++;
-                            if(count >= max) return count;
-                        }
-                    }
-                }
-            }
-        }
-    }
-
-    return count;
+	struct PciScan scan;
+	
+	scan.functionList = functionList;
+	scan.max = max;
+	scan.count = 0;
+	for(int i = 0; i < 256 / 32; i++) {
+		scan.scannedBuses[i] = 0;
+	}
+	
+	//a multi-function host bridge at 0:0 has one host controller per
+	//function, and function n owns bus n
+	if((pciConfigReadInt8(0, 0, 0, PCI_HDR_HEADER_TYPE) & 0x80) == 0) {
+		scanBus(&scan, 0);
+	}
+	else {
+		for(int fn = 0; fn < 8 && scan.count < max; fn++) {
+			if(pciDeviceExists(0, 0, fn))
+				scanBus(&scan, fn);
+		}
+	}
+	
+	return scan.count;
+}
+
+//registry: records come from a slab cache; devices[] keeps scan order
+static struct HeapCache deviceCache;
+static struct PciDevice **devices = 0;
+static uint16_t deviceCount = 0;
+static struct PciDevice *idBuckets[1 << PCI_HASH_BITS];
+static struct PciDevice *classBuckets[1 << PCI_HASH_BITS];
+
+//multiplicative hash; the top bits are the best mixed
+static uint32_t hashKey(uint32_t key) {
+	return (key * 0x9E3779B1UL) >> (32 - PCI_HASH_BITS);
+}
+
+static uint32_t idKey(uint16_t vendorId, uint16_t deviceId) {
+	return (uint32_t) vendorId << 16 | deviceId;
+}
+
+static uint32_t classKey(uint8_t classCode, uint8_t subclass, uint8_t progIf) {
+	return (uint32_t) classCode << 16 | (uint32_t) subclass << 8 | progIf;
+}
+
+//referenced https://wiki.osdev.org/PCI#Base_Address_Registers
+//writes all ones to each BAR and reads back which address bits are fixed
+//at zero; the lowest writable bit gives the size. decoding is turned off
+//meanwhile so the device never answers at the temporary address.
+static void sizeBars(struct PciDevice *dev) {
+	uint8_t b = dev->bus, d = dev->device, f = dev->function;
+	uint8_t headerType = dev->table.headerType & 0x7F;
+	int count = headerType == 0 ? 6 : headerType == 1 ? 2 : 1;
+	uint16_t command;
+	uint32_t flags;
+	
+	for(int i = 0; i < PCI_MAX_BARS; i++) {
+		dev->bars[i].base = 0;
+		dev->bars[i].size = 0;
+		dev->bars[i].flags = 0;
+	}
+	
+	flags = x86_disableInterrupts();
+	command = pciConfigReadInt16(b, d, f, PCI_HDR_COMMAND);
+	pciConfigWriteInt16(b, d, f, PCI_HDR_COMMAND, command & ~0x0003); //I/O, memory
+	
+	for(int i = 0; i < count; i++) {
+		struct PciBar *bar = &dev->bars[i];
+		uint16_t offset = PCI_HDR0_BAR0 + 4 * i;
+		uint32_t original = pciConfigReadInt32(b, d, f, offset);
+		uint32_t mask;
+		uint64_t mask64;
+		
+		pciConfigWriteInt32(b, d, f, offset, 0xFFFFFFFF);
+		mask = pciConfigReadInt32(b, d, f, offset);
+		pciConfigWriteInt32(b, d, f, offset, original);
+		
+		if(original & 1) { //I/O: bits 1-0 are flags; the top half may read 0
+			mask &= ~0x3;
+			if(mask == 0) continue;
+			if((mask >> 16) == 0) mask |= 0xFFFF0000;
+			
+			bar->base = original & ~0x3;
+			bar->size = ~mask + 1;
+			bar->flags = PCI_BAR_IO;
+			continue;
+		}
+		
+		mask64 = 0xFFFFFFFF00000000ULL | (mask & ~0xF);
+		bar->base = original & ~0xF;
+		bar->flags = (original & 0x8) ? PCI_BAR_PREFETCHABLE : 0;
+		
+		if(((original >> 1) & 3) == 2 && i + 1 < count) { //64-bit: sized as one
+			uint32_t upper = pciConfigReadInt32(b, d, f, offset + 4);
+			
+			pciConfigWriteInt32(b, d, f, offset + 4, 0xFFFFFFFF);
+			mask64 = (uint64_t) pciConfigReadInt32(b, d, f, offset + 4) << 32 | (mask & ~0xF);
+			pciConfigWriteInt32(b, d, f, offset + 4, upper);
+			
+			bar->base |= (uint64_t) upper << 32;
+			bar->flags |= PCI_BAR_64BIT;
+			i++; //the upper half stays empty
+		}
+		
+		if((mask & ~0xF) != 0 || (mask64 >> 32) != 0xFFFFFFFF)
+			bar->size = ~mask64 + 1;
+		else
+			bar->base = 0; //not implemented
+	}
+	
+	pciConfigWriteInt16(b, d, f, PCI_HDR_COMMAND, command);
+	x86_restoreInterrupts(flags);
+}
+
+void *pciMapBar(const struct PciDevice *dev, int index) {
+	const struct PciBar *bar;
+	uint16_t command;
+	
+	if(index < 0 || index >= PCI_MAX_BARS)
+		return 0;
+	
+	bar = &dev->bars[index];
+	if(bar->size == 0 || (bar->flags & PCI_BAR_IO) || ((bar->base + bar->size - 1) >> 32) != 0)
+		return 0;
+	
+	command = pciConfigReadInt16(dev->bus, dev->device, dev->function, PCI_HDR_COMMAND);
+	if(!(command & 0x0002))
+		pciConfigWriteInt16(dev->bus, dev->device, dev->function, PCI_HDR_COMMAND, command | 0x0002);
+	
+	//write combining lets the CPU merge stores into bursts, which is only
+	//safe where reads and writes have no side effects
+	return paging_mapDevice((uint32_t) bar->base, (uint32_t) bar->size,
+	  (bar->flags & PCI_BAR_PREFETCHABLE) ? PAGING_CACHE_WRITE_COMBINING : PAGING_CACHE_UNCACHED);
+}
+
+uint16_t pciRegistryInit(void) {
+	static uint16_t functions[PCI_MAX_FUNCTIONS];
+	struct PciDevice **idTail[1 << PCI_HASH_BITS];
+	struct PciDevice **classTail[1 << PCI_HASH_BITS];
+	uint16_t count = pciEnumerate(functions, PCI_MAX_FUNCTIONS);
+	
+	deviceCount = 0;
+	if(heap_createCache(&deviceCache, "pci", sizeof(struct PciDevice)) != 0)
+		return 0;
+	
+	devices = kmalloc(count * sizeof(struct PciDevice *));
+	if(devices == 0)
+		return 0;
+	
+	//chains are appended to at the tail so lookups return scan order
+	for(int i = 0; i < (1 << PCI_HASH_BITS); i++) {
+		idBuckets[i] = 0;
+		classBuckets[i] = 0;
+		idTail[i] = &idBuckets[i];
+		classTail[i] = &classBuckets[i];
+	}
+	
+	for(uint16_t i = 0; i < count; i++) {
+		struct PciDevice *dev = heap_cacheAlloc(&deviceCache);
+		uint32_t idHash;
+		uint32_t classHash;
+		
+		if(dev == 0)
+			break;
+		
+		dev->bus = functions[i] >> 8;
+		dev->device = (functions[i] >> 3) & 0x1F;
+		dev->function = functions[i] & 0x07;
+		dev->nextById = 0;
+		dev->nextByClass = 0;
+		dev->irqMode = PCI_IRQ_INTX;
+		dev->irqVector = 0;
+		dev->irqCount = 0;
+		dev->irqCommand = 0;
+		dev->msixTable = 0;
+		pciReadTable(dev->bus, dev->device, dev->function, &dev->table);
+		sizeBars(dev);
+		
+		idHash = hashKey(idKey(dev->table.vendorId, dev->table.deviceId));
+		classHash = hashKey(classKey(dev->table.classCode, dev->table.subclass, dev->table.progIf));
+		*idTail[idHash] = dev;
+		idTail[idHash] = &dev->nextById;
+		*classTail[classHash] = dev;
+		classTail[classHash] = &dev->nextByClass;
+		
+		devices[deviceCount++] = dev;
+	}
+	
+	return deviceCount;
+}
+
+uint16_t pciGetDeviceCount(void) {
+	return deviceCount;
+}
+
+const struct PciDevice *pciGetDevice(uint16_t index) {
+	return index < deviceCount ? devices[index] : 0;
+}
+
+const struct PciDevice *pciFindById(uint16_t vendorId, uint16_t deviceId,
+  const struct PciDevice *prev) {
+	const struct PciDevice *dev = prev ? prev->nextById :
+	  idBuckets[hashKey(idKey(vendorId, deviceId))];
+	
+	while(dev && (dev->table.vendorId != vendorId || dev->table.deviceId != deviceId)) {
+		dev = dev->nextById;
+	}
+	
+	return dev;
+}
+
+const struct PciDevice *pciFindByClass(uint8_t classCode, uint8_t subclass,
+  uint8_t progIf, const struct PciDevice *prev) {
+	const struct PciDevice *dev = prev ? prev->nextByClass :
+	  classBuckets[hashKey(classKey(classCode, subclass, progIf))];
+	
+	while(dev && (dev->table.classCode != classCode || dev->table.subclass != subclass ||
+	  dev->table.progIf != progIf)) {
+		dev = dev->nextByClass;
+	}
+	
+	return dev;
+}
+
+//referenced https://wiki.osdev.org/PCI#Capabilities_List
+//the list never changes, so it is walked in the registry's copy of the
+//header rather than with configuration cycles. each entry is {id, next}
+//and the chain lives above the 64-byte header.
+uint16_t pciFindCapability(const struct PciDevice *dev, uint8_t id, uint16_t prev) {
+	const uint8_t *config = (const uint8_t *) &dev->table;
+	int limit = (PCI_CONFIG_SPACE_SIZE - 0x40) / 4; //stops malformed loops
+	uint8_t offset;
+	
+	if(!(dev->table.status & PCI_STATUS_CAPABILITIES_LIST))
+		return 0;
+	
+	if(prev != 0)
+		offset = config[(prev + 1) & 0xFF];
+	else if((dev->table.headerType & 0x7F) == 2)
+		offset = dev->table.hdr2.capabilitiesOffset;
+	else
+		offset = dev->table.hdr0.capabilitiesPtr; //same place in type 1
+	
+	while(limit-- > 0) {
+		offset &= 0xFC;
+		if(offset < 0x40)
+			return 0;
+		if(config[offset] == id)
+			return offset;
+		offset = config[offset + 1];
+	}
+	
+	return 0;
+}
+
+//extended capability headers are {id:16, version:4, next:12}
+uint16_t pciFindExtendedCapability(const struct PciDevice *dev, uint16_t id, uint16_t prev) {
+	int limit = (PCI_EXTENDED_CONFIG_SPACE_SIZE - PCI_CONFIG_SPACE_SIZE) / 4;
+	uint32_t header;
+	uint16_t offset;
+	
+	if(accessMethod != PCI_ACCESS_ECAM || pciFindCapability(dev, PCI_CAP_ID_PCI_EXPRESS, 0) == 0)
+		return 0;
+	
+	if(prev != 0)
+		offset = pciConfigReadInt32(dev->bus, dev->device, dev->function, prev) >> 20;
+	else
+		offset = PCI_CONFIG_SPACE_SIZE;
+	
+	while(limit-- > 0) {
+		offset &= 0xFFC;
+		if(offset < PCI_CONFIG_SPACE_SIZE)
+			return 0;
+		
+		header = pciConfigReadInt32(dev->bus, dev->device, dev->function, offset);
+		if(header == 0 || header == 0xFFFFFFFF)
+			return 0;
+		if((header & 0xFFFF) == id)
+			return offset;
+		offset = header >> 20;
+	}
+	
+	return 0;
+}
+
+//referenced https://wiki.osdev.org/PCI#Message_Signaled_Interrupts
+//fixed delivery, edge triggered, to this CPU
+static uint32_t msiAddress(void) {
+	return APIC_MSI_ADDRESS | (uint32_t) apic_getId() << 12;
+}
+
+//the function adds its message number to the data register, so the
+//vectors must be a block aligned to its size
+static int enableMsi(struct PciDevice *dev, uint16_t cap,
+  void (*const *isrs)(struct interrupt_frame *), uint8_t count) {
+	uint8_t b = dev->bus, d = dev->device, f = dev->function;
+	uint16_t control = pciConfigReadInt16(b, d, f, cap + PCI_MSI_CONTROL);
+	uint8_t capable = 1 << ((control >> 1) & 0x7); //multiple message capable
+	uint8_t n = 1;
+	uint8_t log2 = 0;
+	int vector;
+	
+	while(n * 2 <= count && n * 2 <= capable && n < 32) {
+		n *= 2;
+		log2++;
+	}
+	
+	vector = allocInterruptVectors(n, n);
+	if(vector < 0)
+		return -1;
+	
+	for(int i = 0; i < n; i++) {
+		setInterruptDescriptor(isrs[i], vector + i, 0);
+	}
+	
+	pciConfigWriteInt32(b, d, f, cap + PCI_MSI_ADDRESS, msiAddress());
+	if(control & PCI_MSI_CONTROL_64BIT) {
+		pciConfigWriteInt32(b, d, f, cap + PCI_MSI_ADDRESS_UPPER, 0);
+		pciConfigWriteInt16(b, d, f, cap + PCI_MSI_DATA_64, vector);
+	}
+	else {
+		pciConfigWriteInt16(b, d, f, cap + PCI_MSI_DATA_32, vector);
+	}
+	
+	control = (control & ~0x0070) | log2 << 4; //multiple message enable
+	pciConfigWriteInt16(b, d, f, cap + PCI_MSI_CONTROL, control | PCI_MSI_CONTROL_ENABLE);
+	
+	dev->irqMode = PCI_IRQ_MSI;
+	dev->irqVector = vector;
+	dev->irqCount = n;
+	return n;
+}
+
+//every table entry has its own address and data, so any vectors will do.
+//the table sits in a memory BAR and is mapped uncached.
+static int enableMsix(struct PciDevice *dev, uint16_t cap,
+  void (*const *isrs)(struct interrupt_frame *), uint8_t count) {
+	uint8_t b = dev->bus, d = dev->device, f = dev->function;
+	uint16_t control = pciConfigReadInt16(b, d, f, cap + PCI_MSIX_CONTROL);
+	uint32_t location = pciConfigReadInt32(b, d, f, cap + PCI_MSIX_TABLE);
+	uint16_t size = (control & PCI_MSIX_CONTROL_TABLE_SIZE) + 1;
+	uint8_t barIndex = location & 0x7;
+	int vector;
+	
+	if(count > size)
+		count = size;
+	
+	if(dev->msixTable == 0) {
+		const struct PciBar *bar = &dev->bars[barIndex];
+		
+		if(barIndex >= PCI_MAX_BARS || bar->size == 0 || (bar->flags & PCI_BAR_IO) || (bar->base >> 32))
+			return -1;
+		
+		dev->msixTable = paging_mapDevice((uint32_t) bar->base + (location & ~0x7),
+		  size * PCI_MSIX_ENTRY_SIZE, PAGING_CACHE_UNCACHED);
+		if(dev->msixTable == 0)
+			return -1;
+	}
+	
+	vector = allocInterruptVectors(count, 1);
+	if(vector < 0)
+		return -1;
+	
+	//no entry can fire while the table is half written
+	pciConfigWriteInt16(b, d, f, cap + PCI_MSIX_CONTROL,
+	  control | PCI_MSIX_CONTROL_ENABLE | PCI_MSIX_CONTROL_FUNCTION_MASK);
+	
+	for(int i = 0; i < size; i++) {
+		volatile uint32_t *entry = dev->msixTable + i * (PCI_MSIX_ENTRY_SIZE / 4);
+		
+		if(i < count) {
+			setInterruptDescriptor(isrs[i], vector + i, 0);
+			entry[0] = msiAddress();
+			entry[1] = 0;
+			entry[2] = vector + i;
+			entry[3] &= ~PCI_MSIX_ENTRY_VECTOR_MASKED;
+		}
+		else {
+			entry[3] |= PCI_MSIX_ENTRY_VECTOR_MASKED;
+		}
+	}
+	
+	pciConfigWriteInt16(b, d, f, cap + PCI_MSIX_CONTROL,
+	  (control | PCI_MSIX_CONTROL_ENABLE) & ~PCI_MSIX_CONTROL_FUNCTION_MASK);
+	
+	dev->irqMode = PCI_IRQ_MSIX;
+	dev->irqVector = vector;
+	dev->irqCount = count;
+	return count;
+}
+
+int pciEnableMsi(const struct PciDevice *constDev,
+  void (*const *isrs)(struct interrupt_frame *), uint8_t count) {
+	struct PciDevice *dev = (struct PciDevice *) constDev; //owned by the registry
+	uint8_t b = dev->bus, d = dev->device, f = dev->function;
+	uint16_t msix = pciFindCapability(dev, PCI_CAP_ID_MSIX, 0);
+	uint16_t msi = pciFindCapability(dev, PCI_CAP_ID_MSI, 0);
+	uint16_t command;
+	int granted;
+	
+	//MSI writes target the local APIC directly
+	if(count == 0 || !apic_isEnabled() || (msix == 0 && msi == 0))
+		return -1;
+	
+	if(dev->irqMode != PCI_IRQ_INTX)
+		pciDisableMsi(dev);
+	
+	//messages are memory writes by the function, and the MSI-X table is
+	//reached through a memory BAR
+	command = pciConfigReadInt16(b, d, f, PCI_HDR_COMMAND);
+	pciConfigWriteInt16(b, d, f, PCI_HDR_COMMAND,
+	  command | PCI_COMMAND_MEMORY_SPACE | PCI_COMMAND_BUS_MASTER);
+	
+	granted = -1;
+	if(msix != 0)
+		granted = enableMsix(dev, msix, isrs, count);
+	if(granted < 0 && msi != 0)
+		granted = enableMsi(dev, msi, isrs, count);
+	
+	if(granted < 0) {
+		pciConfigWriteInt16(b, d, f, PCI_HDR_COMMAND, command);
+		return -1;
+	}
+	
+	pciConfigWriteInt16(b, d, f, PCI_HDR_COMMAND,
+	  command | PCI_COMMAND_MEMORY_SPACE | PCI_COMMAND_BUS_MASTER | PCI_COMMAND_INTX_DISABLE);
+	dev->irqCommand = command;
+	return granted;
+}
+
+void pciDisableMsi(const struct PciDevice *constDev) {
+	struct PciDevice *dev = (struct PciDevice *) constDev; //owned by the registry
+	uint8_t b = dev->bus, d = dev->device, f = dev->function;
+	uint16_t cap;
+	
+	if(dev->irqMode == PCI_IRQ_MSIX) {
+		cap = pciFindCapability(dev, PCI_CAP_ID_MSIX, 0);
+		pciConfigWriteInt16(b, d, f, cap + PCI_MSIX_CONTROL,
+		  pciConfigReadInt16(b, d, f, cap + PCI_MSIX_CONTROL) & ~PCI_MSIX_CONTROL_ENABLE);
+	}
+	else if(dev->irqMode == PCI_IRQ_MSI) {
+		cap = pciFindCapability(dev, PCI_CAP_ID_MSI, 0);
+		pciConfigWriteInt16(b, d, f, cap + PCI_MSI_CONTROL,
+		  pciConfigReadInt16(b, d, f, cap + PCI_MSI_CONTROL) & ~PCI_MSI_CONTROL_ENABLE);
+	}
+	else {
+		return;
+	}
+	
+	//a driverless function must not keep bus mastering on
+	pciConfigWriteInt16(b, d, f, PCI_HDR_COMMAND, dev->irqCommand);
+	
+	//a message already in flight lands on a harmless gate
+	for(int i = 0; i < dev->irqCount; i++) {
+		setInterruptDescriptor(isr_spurious, dev->irqVector + i, 0);
+	}
+	freeInterruptVectors(dev->irqVector, dev->irqCount);
+	
+	dev->irqMode = PCI_IRQ_INTX;
+	dev->irqVector = 0;
+	dev->irqCount = 0;
 }
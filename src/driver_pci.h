@@ -3,6 +3,12 @@
  * Started: July 12, 2021
  * Updated: May 29, 2023
  * PCI Driver Header
+ *
+ * Configuration space is read through the PCIe enhanced configuration
+ * access mechanism (ECAM) when the ACPI MCFG table describes it, otherwise
+ * through ports 0xCF8/0xCFC. Offsets are 16 bits so the 4 KiB extended
+ * space can be reached through ECAM; with the legacy mechanism, offsets
+ * past 0xFF read as all ones and writes to them are ignored.
  */
 
 #ifndef DRIVER_PCI_H
@@ -97,6 +103,57 @@
 #define PCI_REG_CFIG_ADDR							0x0CF8
 #define PCI_REG_CFIG_DATA							0x0CFC
 
+#define PCI_CONFIG_SPACE_SIZE						0x100
+#define PCI_EXTENDED_CONFIG_SPACE_SIZE				0x1000
+
+#define PCI_ACCESS_LEGACY							0 //ports 0xCF8/0xCFC
+#define PCI_ACCESS_ECAM								1 //memory mapped
+
+#define PCI_COMMAND_IO_SPACE						0x0001
+#define PCI_COMMAND_MEMORY_SPACE					0x0002
+#define PCI_COMMAND_BUS_MASTER						0x0004
+#define PCI_COMMAND_INTX_DISABLE					0x0400
+
+#define PCI_STATUS_CAPABILITIES_LIST				0x0010
+
+//capability IDs; extended capabilities start at PCI_CONFIG_SPACE_SIZE
+#define PCI_CAP_ID_POWER_MANAGEMENT					0x01
+#define PCI_CAP_ID_MSI								0x05
+#define PCI_CAP_ID_VENDOR_SPECIFIC					0x09
+#define PCI_CAP_ID_PCI_EXPRESS						0x10
+#define PCI_CAP_ID_MSIX								0x11
+
+#define PCI_EXT_CAP_ID_AER							0x0001
+#define PCI_EXT_CAP_ID_SERIAL_NUMBER				0x0003
+
+//offsets within the MSI capability; the data register follows the
+//upper address dword only if the function supports 64-bit addresses
+#define PCI_MSI_CONTROL								0x02
+#define PCI_MSI_ADDRESS								0x04
+#define PCI_MSI_ADDRESS_UPPER						0x08
+#define PCI_MSI_DATA_32								0x08
+#define PCI_MSI_DATA_64								0x0C
+
+#define PCI_MSI_CONTROL_ENABLE						0x0001
+#define PCI_MSI_CONTROL_64BIT						0x0080
+
+//offsets within the MSI-X capability and its table entries
+#define PCI_MSIX_CONTROL							0x02
+#define PCI_MSIX_TABLE								0x04 //offset | BAR index
+#define PCI_MSIX_PBA								0x08
+
+#define PCI_MSIX_CONTROL_TABLE_SIZE					0x07FF //entries - 1
+#define PCI_MSIX_CONTROL_FUNCTION_MASK				0x4000
+#define PCI_MSIX_CONTROL_ENABLE						0x8000
+
+#define PCI_MSIX_ENTRY_SIZE							16
+#define PCI_MSIX_ENTRY_VECTOR_MASKED				0x00000001
+
+//PciDevice interrupt modes
+#define PCI_IRQ_INTX								0 //legacy, shared line
+#define PCI_IRQ_MSI									1
+#define PCI_IRQ_MSIX								2
+
 struct PCI_TABLE {
 	uint16_t vendorId;
 	uint16_t deviceId;
@@ -156,19 +213,123 @@ struct PCI_TABLE {
 			uint16_t bridgeControl;
 		} hdr1;
 		
-		struct PCI_HDR2 {
-			uint8_t placeholder;
+		struct PCI_HDR2 { //CardBus bridge
+			uint32_t cardbusBaseAddr;
+			uint8_t capabilitiesOffset;
+			uint8_t reserved;
+			uint16_t secondaryStatus;
+			uint8_t pciBusNumber;
+			uint8_t cardbusBusNumber;
+			uint8_t subordinateBusNumber;
+			uint8_t cardbusLatencyTimer;
+			uint32_t memoryBaseAddr0;
+			uint32_t memoryLimit0;
+			uint32_t memoryBaseAddr1;
+			uint32_t memoryLimit1;
+			uint32_t ioBaseAddr0;
+			uint32_t ioLimit0;
+			uint32_t ioBaseAddr1;
+			uint32_t ioLimit1;
+			uint8_t interruptLine;
+			uint8_t interruptPin;
+			uint16_t bridgeControl;
+			uint16_t subsystemDeviceId;
+			uint16_t subsystemVendorId;
+			uint32_t pcCardBaseAddr;
 		} hdr2;
 		
-		uint8_t deviceSpecific[192]; //ensures that total struct size is 256 bytes
+		uint8_t deviceSpecific[240]; //ensures that total struct size is 256 bytes
 	};
 };
 
+//maps the ECAM region of PCI segment 0 if the MCFG table lists one.
+//acpi_init must be called first. returns the access method in use.
+uint8_t pciInit(void);
+uint8_t pciGetAccessMethod(void);
+
+//for benchmarks: returns -1 if ECAM is requested but unavailable
+int pciSetAccessMethod(uint8_t method);
+
+#define PCI_MAX_BARS								6
+
+//PciBar flags
+#define PCI_BAR_IO									0x01 //I/O ports, not memory
+#define PCI_BAR_64BIT								0x02 //uses the next BAR slot too
+#define PCI_BAR_PREFETCHABLE						0x04 //reads have no side effects
+
+//a decoded base address register; size is 0 if the BAR is not implemented
+//(or is the upper half of a 64-bit BAR)
+struct PciBar {
+	uint64_t base;
+	uint64_t size;
+	uint8_t flags;
+};
+
+//a function found at boot, with a copy of its configuration header
+struct PciDevice {
+	uint8_t bus;
+	uint8_t device;
+	uint8_t function;
+	struct PciDevice *nextById; //hash chains of the registry
+	struct PciDevice *nextByClass;
+	struct PciBar bars[PCI_MAX_BARS]; //sized once by pciRegistryInit()
+	uint8_t irqMode; //PCI_IRQ_*, set by pciEnableMsi()
+	uint8_t irqVector; //first of irqCount consecutive vectors
+	uint8_t irqCount;
+	uint16_t irqCommand; //command register before pciEnableMsi()
+	volatile uint32_t *msixTable; //mapped on first use
+	struct PCI_TABLE table;
+};
+
 void pciReadTable(uint8_t bus, uint8_t device, uint8_t function, struct PCI_TABLE *table);
 
-uint32_t pciConfigReadInt32(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset);
-uint16_t pciConfigReadInt16(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset);
-uint8_t pciConfigReadInt8(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset);
+//scans once and keeps every function's header (pciInit and heap_init
+//must be called first); returns the number of functions. the lookups
+//below only read memory; they make no configuration cycles.
+uint16_t pciRegistryInit(void);
+uint16_t pciGetDeviceCount(void);
+const struct PciDevice *pciGetDevice(uint16_t index); //in scan order
+
+//return the next match after prev (0 for the first), or 0 when there are
+//no more; matches come in scan order
+const struct PciDevice *pciFindById(uint16_t vendorId, uint16_t deviceId,
+  const struct PciDevice *prev);
+const struct PciDevice *pciFindByClass(uint8_t classCode, uint8_t subclass,
+  uint8_t progIf, const struct PciDevice *prev);
+
+//maps a memory BAR and enables memory decoding for the function.
+//prefetchable BARs are mapped write-combining, others uncached. returns
+//0 for I/O or unimplemented BARs, or if the BAR lies above 4 GiB.
+void *pciMapBar(const struct PciDevice *dev, int index);
+
+//walk the capability list (in the header) or the extended list (from
+//offset 0x100, PCIe functions through ECAM only). return the offset of
+//the next capability with the given ID after prev (0 to start from the
+//beginning), or 0 if there is none.
+uint16_t pciFindCapability(const struct PciDevice *dev, uint8_t id, uint16_t prev);
+uint16_t pciFindExtendedCapability(const struct PciDevice *dev, uint16_t id, uint16_t prev);
+
+struct interrupt_frame;
+
+//gives the function dedicated vectors in place of its INTx line: isrs[i]
+//handles MSI-X table entry i, or MSI message i if there is no MSI-X (MSI
+//grants only a power of 2, at most 32). handlers must end with
+//apic_eoi(). needs the local APIC. returns the number of vectors given,
+//which may be less than count, or -1 if the function supports neither.
+int pciEnableMsi(const struct PciDevice *dev,
+  void (*const *isrs)(struct interrupt_frame *), uint8_t count);
+
+//returns the function to INTx, restores its command register and frees
+//its vectors
+void pciDisableMsi(const struct PciDevice *dev);
+
+uint32_t pciConfigReadInt32(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset);
+uint16_t pciConfigReadInt16(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset);
+uint8_t pciConfigReadInt8(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset);
+
+void pciConfigWriteInt32(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint32_t value);
+void pciConfigWriteInt16(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint16_t value);
+void pciConfigWriteInt8(uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint8_t value);
 
 bool pciDeviceExists(uint8_t bus, uint8_t device, uint8_t function);
 
@@ -0,0 +1,97 @@
+/* J. Kent Wirant
+ * osmium
+ * event.c
+ * Description: Event flags posted by interrupt handlers and an idle wait
+ *   for the main loop, which sleeps in HLT or MWAIT until work arrives.
+ */
+
+//referenced https://www.felixcloutier.com/x86/mwait
+
+#include "event.h"
+#include "timer.h"
+#include "x86_util.h"
+
+#define CPUID_ECX_MONITOR (1UL << 3)
+
+//the monitored line must not be written by anything but posts, so the
+//flags get a cache line of their own (the alignment also pads the size)
+static struct {
+	volatile uint32_t events;
+} __attribute__((aligned(64))) pending;
+
+static int checkedCpu = 0;
+static int useMwait = 0;
+static uint64_t idleUs = 0;
+static uint32_t wakeups = 0;
+
+void event_post(uint32_t events) {
+	asm volatile ("lock orl %1, %0" : "+m" (pending.events) : "r" (events) : "memory");
+}
+
+static uint32_t takePending(void) {
+	uint32_t events = 0;
+	asm volatile ("xchgl %0, %1" : "+r" (events), "+m" (pending.events) : : "memory");
+	return events;
+}
+
+//sleeps until an interrupt (or, with MWAIT, a post). IF is clear on
+//entry so an interrupt cannot post between the last check and the sleep:
+//STI only takes effect after the following instruction.
+static void sleep(void) {
+	if(useMwait) {
+		asm volatile ("monitor" : : "a" (&pending.events), "c" (0), "d" (0));
+		
+		if(pending.events == 0)
+			asm volatile ("sti; mwait" : : "a" (0), "c" (0) : "memory");
+		else
+			asm volatile ("sti" : : : "memory");
+	}
+	else {
+		asm volatile ("sti; hlt" : : : "memory");
+	}
+}
+
+uint32_t event_wait(void) {
+	uint32_t events;
+	uint64_t start;
+	
+	if(!checkedCpu) {
+		uint32_t regs[4];
+		x86_cpuid(1, regs);
+		useMwait = (regs[2] & CPUID_ECX_MONITOR) != 0;
+		checkedCpu = 1;
+	}
+	
+	while(1) {
+		asm volatile ("cli" : : : "memory");
+		events = takePending();
+		
+		if(events) {
+			asm volatile ("sti" : : : "memory");
+			return events;
+		}
+		
+		start = timer_nowUs();
+		sleep(); //returns with interrupts enabled
+		idleUs += timer_nowUs() - start;
+		wakeups++;
+	}
+}
+
+void event_getIdleStats(struct IdleStats *stats) {
+	uint64_t idle = idleUs;
+	uint64_t total = timer_nowUs();
+	
+	stats->idleUs = idle;
+	stats->totalUs = total;
+	stats->wakeups = wakeups;
+	stats->usesMwait = useMwait;
+	
+	//scale down so the percentage needs only 32-bit arithmetic
+	while(total >> 25) {
+		total >>= 1;
+		idle >>= 1;
+	}
+	
+	stats->percentIdle = (total > 0) ? (uint32_t) idle * 100 / (uint32_t) total : 0;
+}
@@ -0,0 +1,33 @@
+/* J. Kent Wirant
+ * osmium
+ * event.h
+ * Description: Event flags posted by interrupt handlers and an idle wait
+ *   for the main loop, which sleeps in HLT or MWAIT until work arrives.
+ */
+
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <stdint.h>
+
+#define EVENT_KEYBOARD (1UL << 0)
+#define EVENT_SERIAL (1UL << 1)
+
+//sets event bits; safe to call from interrupt handlers
+void event_post(uint32_t events);
+
+//returns and clears all pending events, sleeping until there is one
+uint32_t event_wait(void);
+
+//idle statistics since boot
+struct IdleStats {
+	uint64_t idleUs; //time spent sleeping in event_wait()
+	uint64_t totalUs;
+	uint32_t wakeups; //interrupts that ended a sleep
+	uint32_t percentIdle;
+	uint8_t usesMwait;
+};
+
+void event_getIdleStats(struct IdleStats *stats);
+
+#endif //EVENT_H
@@ -0,0 +1,113 @@
+; Author: J. Kent Wirant
+; osmium
+; exception_stubs.asm
+; Entry stubs for CPU exceptions (vectors 0-31) and setjmp/longjmp.
+
+; Every stub leaves the same frame on the stack: the registers pushed by
+; pushad, the vector, an error code (0 if the CPU does not push one), and
+; the CPU's EIP, CS and EFLAGS. exception_handler receives a pointer to it
+; as a struct ExceptionFrame (exceptions.h).
+
+section .text
+bits 32
+
+[extern exception_handler]
+	global exception_stubs
+	global setjmp
+	global longjmp
+
+; vectors without an error code push a dummy one
+%macro EXCEPTION_NO_ERROR 1
+exception_stub%1:
+	push dword 0
+	push dword %1
+	jmp exception_common
+%endmacro
+
+%macro EXCEPTION_ERROR 1
+exception_stub%1:
+	push dword %1
+	jmp exception_common
+%endmacro
+
+EXCEPTION_NO_ERROR 0	; divide error
+EXCEPTION_NO_ERROR 1	; debug
+EXCEPTION_NO_ERROR 2	; NMI
+EXCEPTION_NO_ERROR 3	; breakpoint
+EXCEPTION_NO_ERROR 4	; overflow
+EXCEPTION_NO_ERROR 5	; bound range exceeded
+EXCEPTION_NO_ERROR 6	; invalid opcode
+EXCEPTION_NO_ERROR 7	; device not available
+EXCEPTION_ERROR    8	; double fault
+EXCEPTION_NO_ERROR 9	; coprocessor segment overrun
+EXCEPTION_ERROR    10	; invalid TSS
+EXCEPTION_ERROR    11	; segment not present
+EXCEPTION_ERROR    12	; stack-segment fault
+EXCEPTION_ERROR    13	; general protection fault
+EXCEPTION_ERROR    14	; page fault
+EXCEPTION_NO_ERROR 15	; reserved
+EXCEPTION_NO_ERROR 16	; x87 floating-point exception
+EXCEPTION_ERROR    17	; alignment check
+EXCEPTION_NO_ERROR 18	; machine check
+EXCEPTION_NO_ERROR 19	; SIMD floating-point exception
+EXCEPTION_NO_ERROR 20	; virtualization exception
+EXCEPTION_ERROR    21	; control protection exception
+EXCEPTION_NO_ERROR 22	; reserved
+EXCEPTION_NO_ERROR 23
+EXCEPTION_NO_ERROR 24
+EXCEPTION_NO_ERROR 25
+EXCEPTION_NO_ERROR 26
+EXCEPTION_NO_ERROR 27
+EXCEPTION_NO_ERROR 28
+EXCEPTION_ERROR    29	; VMM communication exception
+EXCEPTION_ERROR    30	; security exception
+EXCEPTION_NO_ERROR 31	; reserved
+
+exception_common:
+	pushad					; eax, ecx, edx, ebx, esp, ebp, esi, edi
+	cld						; the C code expects the direction flag clear
+	push esp				; struct ExceptionFrame *
+	call exception_handler
+	add esp, 4
+	popad
+	add esp, 8				; vector and error code
+	iret
+
+; addresses of the stubs, indexed by vector
+exception_stubs:
+%assign vector 0
+%rep 32
+	dd exception_stub %+ vector
+%assign vector vector + 1
+%endrep
+
+; int setjmp(jmp_buf env): saves the callee-saved registers, the stack
+; pointer and the return address; returns 0
+setjmp:
+	mov eax, [esp + 4]		; env
+	mov [eax], ebx
+	mov [eax + 4], esi
+	mov [eax + 8], edi
+	mov [eax + 12], ebp
+	lea ecx, [esp + 4]		; stack pointer after returning
+	mov [eax + 16], ecx
+	mov ecx, [esp]			; return address
+	mov [eax + 20], ecx
+	xor eax, eax
+	ret
+
+; void longjmp(jmp_buf env, int value): returns from setjmp again with
+; value (1 if value is 0)
+longjmp:
+	mov edx, [esp + 4]		; env
+	mov eax, [esp + 8]		; value
+	test eax, eax
+	jnz .restore
+	inc eax
+.restore:
+	mov ebx, [edx]
+	mov esi, [edx + 4]
+	mov edi, [edx + 8]
+	mov ebp, [edx + 12]
+	mov esp, [edx + 16]
+	jmp [edx + 20]
@@ -0,0 +1,170 @@
+/* J. Kent Wirant
+ * osmium
+ * exceptions.c
+ * Description: Handlers for CPU exceptions (vectors 0-31). A fault is
+ *   dumped to COM1 and, if a recovery point is set, execution resumes
+ *   there; otherwise the dump is shown on screen and the CPU halts.
+ */
+
+//referenced https://wiki.osdev.org/Exceptions
+
+#include "exceptions.h"
+#include "interrupts.h"
+#include "paging.h"
+#include "serial.h"
+#include "string_util.h"
+#include "text_util.h"
+#include "x86_util.h"
+
+#define BACKTRACE_DEPTH 8 //return addresses that fit on one line
+
+extern void (*exception_stubs[32])(void); //exception_stubs.asm
+
+static const char *names[32] = {
+	"#DE divide error", "#DB debug", "NMI", "#BP breakpoint",
+	"#OF overflow", "#BR bound range", "#UD invalid opcode", "#NM no FPU",
+	"#DF double fault", "coprocessor overrun", "#TS invalid TSS", "#NP segment not present",
+	"#SS stack fault", "#GP protection fault", "#PF page fault", "reserved",
+	"#MF x87 error", "#AC alignment check", "#MC machine check", "#XM SIMD error",
+	"#VE virtualization", "#CP control protection", "reserved", "reserved",
+	"reserved", "reserved", "reserved", "reserved",
+	"#HV hypervisor", "#VC VMM communication", "#SX security", "reserved"
+};
+
+static char dump[EXCEPTION_DUMP_LINES * EXCEPTION_DUMP_COLS];
+static jmp_buf *recovery = 0;
+static volatile int handling = 0; //set while a dump is being made
+
+void exceptions_init(void) {
+	for(int i = 0; i < 32; i++) {
+		//interrupt gates: IRQs stay off while the dump is made
+		setInterruptDescriptor((void (*)(struct interrupt_frame *)) exception_stubs[i], i, 0);
+	}
+}
+
+void exceptions_setRecovery(jmp_buf *env) {
+	recovery = env;
+}
+
+const char *exceptions_getDump(void) {
+	return dump;
+}
+
+//writes "name=XXXXXXXX " and returns the position after it
+static char *putRegister(char *dest, const char *name, uint32_t value) {
+	int length = strlen(name);
+	
+	strncpy_safe(dest, name, length);
+	dest[length] = '=';
+	intToHexStr(dest + length + 1, value, 8);
+	dest[length + 9] = ' ';
+	return dest + length + 10;
+}
+
+//a frame is followed only if its saved EBP and return address can be read
+static int isFrameReadable(uint32_t ebp) {
+	return ebp != 0 && (ebp & 3) == 0 && paging_isMapped(ebp) && paging_isMapped(ebp + 4);
+}
+
+static void formatDump(const struct ExceptionFrame *frame) {
+	char *line;
+	char *dest;
+	uint32_t ebp = frame->ebp;
+	uint32_t next;
+	
+	for(int i = 0; i < EXCEPTION_DUMP_LINES * EXCEPTION_DUMP_COLS; i++) {
+		dump[i] = ' ';
+	}
+	
+	//vector, error code, and where it happened
+	line = &dump[0];
+	strncpy_safe(line, names[frame->vector & 31], strlen(names[frame->vector & 31]));
+	dest = line + 24;
+	dest = putRegister(dest, "err", frame->errorCode);
+	if(frame->vector == 14) dest = putRegister(dest, "cr2", x86_readCR2());
+	dest = putRegister(dest, "eip", frame->eip);
+	
+	//general registers; ESP before the exception is just above the frame
+	//(no privilege change, so the CPU pushed no SS:ESP)
+	line = &dump[EXCEPTION_DUMP_COLS];
+	dest = putRegister(line, "eax", frame->eax);
+	dest = putRegister(dest, "ebx", frame->ebx);
+	dest = putRegister(dest, "ecx", frame->ecx);
+	dest = putRegister(dest, "edx", frame->edx);
+	dest = putRegister(dest, "esi", frame->esi);
+	dest = putRegister(dest, "edi", frame->edi);
+	
+	line = &dump[2 * EXCEPTION_DUMP_COLS];
+	dest = putRegister(line, "ebp", frame->ebp);
+	dest = putRegister(dest, "esp", (uint32_t) &frame->eflags + 4);
+	dest = putRegister(dest, "efl", frame->eflags);
+	dest = putRegister(dest, "cs", frame->cs);
+	
+	//return addresses from the EBP chain (the kernel keeps frame pointers)
+	line = &dump[3 * EXCEPTION_DUMP_COLS];
+	strncpy_safe(line, "trace:", 6);
+	dest = line + 7;
+	
+	for(int i = 0; i < BACKTRACE_DEPTH && isFrameReadable(ebp); i++) {
+		intToHexStr(dest, ((uint32_t *) ebp)[1], 8);
+		dest[8] = ' ';
+		dest += 9;
+		
+		//frames must move up the stack, which also stops loops
+		next = ((uint32_t *) ebp)[0];
+		if(next <= ebp) break;
+		ebp = next;
+	}
+	
+	for(int i = 0; i < EXCEPTION_DUMP_LINES * EXCEPTION_DUMP_COLS; i++) {
+		if(dump[i] == 0) dump[i] = ' ';
+	}
+}
+
+static void writeDumpToSerial(void) {
+	char line[EXCEPTION_DUMP_COLS + 1];
+	
+	serial_write("\n*** exception ***\n");
+	
+	for(int i = 0; i < EXCEPTION_DUMP_LINES; i++) {
+		strncpy_safe(line, &dump[i * EXCEPTION_DUMP_COLS], EXCEPTION_DUMP_COLS);
+		line[EXCEPTION_DUMP_COLS] = 0;
+		serial_write(line);
+		serial_write("\n");
+	}
+}
+
+static void writeDumpToScreen(void) {
+	char line[EXCEPTION_DUMP_COLS + 1];
+	
+	setTextColor(COLOR_WHITE, COLOR_RED);
+	
+	for(int i = 0; i < EXCEPTION_DUMP_LINES; i++) {
+		strncpy_safe(line, &dump[i * EXCEPTION_DUMP_COLS], EXCEPTION_DUMP_COLS);
+		line[EXCEPTION_DUMP_COLS] = 0;
+		setCursorPosition(i, 0);
+		printRaw(line);
+	}
+	
+	flushDisplay();
+}
+
+void exception_handler(struct ExceptionFrame *frame) {
+	//a fault while dumping a fault would recurse; stop immediately
+	if(handling) {
+		while(1) asm volatile ("cli; hlt");
+	}
+	
+	handling = 1;
+	formatDump(frame);
+	writeDumpToSerial();
+	
+	//NMI, double faults and machine checks leave the CPU state in doubt
+	if(recovery && frame->vector != 2 && frame->vector != 8 && frame->vector != 18) {
+		handling = 0;
+		longjmp(*recovery, frame->vector + 1);
+	}
+	
+	writeDumpToScreen();
+	while(1) asm volatile ("cli; hlt");
+}
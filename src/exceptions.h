@@ -0,0 +1,43 @@
+/* J. Kent Wirant
+ * osmium
+ * exceptions.h
+ * Description: Handlers for CPU exceptions (vectors 0-31). A fault is
+ *   dumped to COM1 and, if a recovery point is set, execution resumes
+ *   there; otherwise the dump is shown on screen and the CPU halts.
+ */
+
+#ifndef EXCEPTIONS_H
+#define EXCEPTIONS_H
+
+#include <stdint.h>
+
+#define EXCEPTION_DUMP_LINES 4
+#define EXCEPTION_DUMP_COLS 80
+
+//stack contents on entry to exception_handler (see exception_stubs.asm)
+struct ExceptionFrame {
+	uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax; //pushad
+	uint32_t vector;
+	uint32_t errorCode; //0 for vectors without one
+	uint32_t eip, cs, eflags; //pushed by the CPU
+};
+
+//ebx, esi, edi, ebp, esp, eip (exception_stubs.asm)
+typedef uint32_t jmp_buf[6];
+int setjmp(jmp_buf env) __attribute__((returns_twice));
+void longjmp(jmp_buf env, int value) __attribute__((noreturn));
+
+//installs the handlers in the IDT (call before loadIdt)
+void exceptions_init(void);
+
+//after a recoverable exception, longjmp(*env, vector + 1) is called with
+//interrupts still disabled. null disables recovery.
+void exceptions_setRecovery(jmp_buf *env);
+
+//the last dump, as EXCEPTION_DUMP_LINES lines of EXCEPTION_DUMP_COLS
+//characters (not null-terminated)
+const char *exceptions_getDump(void);
+
+void exception_handler(struct ExceptionFrame *frame);
+
+#endif //EXCEPTIONS_H
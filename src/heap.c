@@ -0,0 +1,210 @@
+/* J. Kent Wirant
+ * osmium
+ * heap.c
+ * Description: Kernel heap. Fixed-size objects come from slab caches
+ *   (one page frame per slab); kmalloc() picks a power-of-two cache by
+ *   size and falls back to whole frame runs for large requests.
+ */
+
+//referenced https://www.kernel.org/doc/gorman/html/understand/understand011.html
+
+#include "heap.h"
+#include "page_frame.h"
+
+#define SIZE_CLASS_COUNT 7 //16 to 1024 bytes
+#define SIZE_CLASS_MIN_SHIFT 4
+
+//every slab and every large allocation starts with this header, so kfree()
+//can find the owner of a pointer from its page address alone
+struct HeapSlab {
+	struct HeapCache *cache; //null for large allocations
+	struct HeapSlab *next; //partial list links
+	struct HeapSlab *prev;
+	void *freeList; //freed objects, linked through their first word
+	uint32_t inUse;
+	uint32_t carved; //objects handed out at least once (bump allocation)
+	uint32_t order; //large allocations: size of the frame run
+	uint32_t reserved;
+};
+
+static struct HeapCache sizeClasses[SIZE_CLASS_COUNT];
+static const char *sizeClassNames[SIZE_CLASS_COUNT] = {
+	"kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+	"kmalloc-256", "kmalloc-512", "kmalloc-1024"
+};
+
+static struct HeapCache *caches = 0;
+static uint32_t largeAllocs = 0;
+static uint32_t largeFrames = 0;
+
+static void unlinkSlab(struct HeapCache *cache, struct HeapSlab *slab) {
+	if(slab->prev) slab->prev->next = slab->next;
+	else cache->partial = slab->next;
+	if(slab->next) slab->next->prev = slab->prev;
+}
+
+static void linkSlab(struct HeapCache *cache, struct HeapSlab *slab) {
+	slab->prev = 0;
+	slab->next = cache->partial;
+	if(slab->next) slab->next->prev = slab;
+	cache->partial = slab;
+}
+
+void heap_init(void) {
+	//created largest first so the cache list starts with the smallest
+	for(int i = SIZE_CLASS_COUNT - 1; i >= 0; i--) {
+		heap_createCache(&sizeClasses[i], sizeClassNames[i], 
+		  1UL << (i + SIZE_CLASS_MIN_SHIFT));
+	}
+}
+
+int heap_createCache(struct HeapCache *cache, const char *name, uint32_t objectSize) {
+	//a slab must hold at least two objects
+	if(objectSize > HEAP_MAX_OBJECT_SIZE)
+		return -1;
+	
+	objectSize = (objectSize + 7) & ~7UL; //room for the free list link
+	if(objectSize == 0) objectSize = 8;
+	
+	cache->name = name;
+	cache->objectSize = objectSize;
+	cache->objectsPerSlab = (PAGE_FRAME_SIZE - HEAP_SLAB_HEADER_SIZE) / objectSize;
+	cache->partial = 0;
+	cache->emptySlabs = 0;
+	cache->inUse = 0;
+	cache->slabs = 0;
+	cache->allocs = 0;
+	cache->frees = 0;
+	cache->failures = 0;
+	
+	cache->next = caches;
+	caches = cache;
+	return 0;
+}
+
+void *heap_cacheAlloc(struct HeapCache *cache) {
+	struct HeapSlab *slab = cache->partial;
+	void *object;
+	
+	if(slab == 0) {
+		slab = (struct HeapSlab *) pageFrame_alloc();
+		
+		if(slab == 0) {
+			cache->failures++;
+			return 0;
+		}
+		
+		slab->cache = cache;
+		slab->freeList = 0;
+		slab->inUse = 0;
+		slab->carved = 0;
+		slab->order = 0;
+		linkSlab(cache, slab);
+		cache->slabs++;
+		cache->emptySlabs++;
+	}
+	
+	//reuse a freed object, or carve the next one from the slab
+	if(slab->freeList) {
+		object = slab->freeList;
+		slab->freeList = *(void **) object;
+	}
+	else {
+		object = (uint8_t *) slab + HEAP_SLAB_HEADER_SIZE + 
+		  slab->carved * cache->objectSize;
+		slab->carved++;
+	}
+	
+	if(slab->inUse == 0) cache->emptySlabs--;
+	slab->inUse++;
+	
+	if(slab->inUse == cache->objectsPerSlab) unlinkSlab(cache, slab);
+	
+	cache->inUse++;
+	cache->allocs++;
+	return object;
+}
+
+static void cacheFree(struct HeapSlab *slab, void *object) {
+	struct HeapCache *cache = slab->cache;
+	
+	if(slab->inUse == cache->objectsPerSlab) linkSlab(cache, slab);
+	
+	*(void **) object = slab->freeList;
+	slab->freeList = object;
+	slab->inUse--;
+	cache->inUse--;
+	cache->frees++;
+	
+	//one empty slab is kept so alternating alloc/free does not thrash
+	if(slab->inUse == 0) {
+		if(cache->emptySlabs > 0) {
+			unlinkSlab(cache, slab);
+			pageFrame_free((uint32_t) slab);
+			cache->slabs--;
+		}
+		else {
+			cache->emptySlabs++;
+		}
+	}
+}
+
+void *kmalloc(size_t size) {
+	uint32_t index = 0;
+	uint32_t order = 0;
+	struct HeapSlab *header;
+	
+	if(size <= (1UL << (SIZE_CLASS_COUNT - 1 + SIZE_CLASS_MIN_SHIFT))) {
+		if(size > (1UL << SIZE_CLASS_MIN_SHIFT))
+			index = 32 - __builtin_clz(size - 1) - SIZE_CLASS_MIN_SHIFT;
+		
+		return heap_cacheAlloc(&sizeClasses[index]);
+	}
+	
+	//large request: a frame run with the header in front of the data
+	while((PAGE_FRAME_SIZE << order) - HEAP_SLAB_HEADER_SIZE < size) {
+		order++;
+		if(order > PAGE_FRAME_MAX_ORDER) return 0;
+	}
+	
+	header = (struct HeapSlab *) pageFrame_allocRun(order);
+	if(header == 0) return 0;
+	
+	header->cache = 0;
+	header->order = order;
+	largeAllocs++;
+	largeFrames += 1UL << order;
+	return (uint8_t *) header + HEAP_SLAB_HEADER_SIZE;
+}
+
+void kfree(void *ptr) {
+	struct HeapSlab *header;
+	
+	if(ptr == 0) return;
+	
+	header = (struct HeapSlab *)((uint32_t) ptr & ~(PAGE_FRAME_SIZE - 1));
+	
+	if(header->cache) {
+		cacheFree(header, ptr);
+	}
+	else {
+		largeFrames -= 1UL << header->order;
+		pageFrame_freeRun((uint32_t) header, header->order);
+	}
+}
+
+struct HeapCache *heap_getCaches(void) {
+	return caches;
+}
+
+void heap_getStats(struct HeapStats *stats) {
+	stats->largeAllocs = largeAllocs;
+	stats->largeFrames = largeFrames;
+	stats->slabFrames = 0;
+	stats->slabBytesUsed = 0;
+	
+	for(struct HeapCache *cache = caches; cache; cache = cache->next) {
+		stats->slabFrames += cache->slabs;
+		stats->slabBytesUsed += cache->inUse * cache->objectSize;
+	}
+}
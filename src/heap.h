@@ -0,0 +1,62 @@
+/* J. Kent Wirant
+ * osmium
+ * heap.h
+ * Description: Kernel heap. Fixed-size objects come from slab caches
+ *   (one page frame per slab); kmalloc() picks a power-of-two cache by
+ *   size and falls back to whole frame runs for large requests.
+ */
+
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stdint.h>
+#include "string_util.h" //size_t
+
+#define HEAP_SLAB_HEADER_SIZE 32
+#define HEAP_MAX_OBJECT_SIZE ((4096 - HEAP_SLAB_HEADER_SIZE) / 2)
+
+struct HeapSlab;
+
+//a cache of equally sized objects; the structure is owned by the caller
+//(usually a static variable in the subsystem that creates it)
+struct HeapCache {
+	const char *name;
+	uint32_t objectSize;
+	uint32_t objectsPerSlab;
+	struct HeapSlab *partial; //slabs with at least one free object
+	uint32_t emptySlabs; //slabs with no objects in use (kept for reuse)
+	struct HeapCache *next; //all caches, for statistics
+	
+	//usage counters
+	uint32_t inUse; //objects currently allocated
+	uint32_t slabs; //page frames held by the cache
+	uint32_t allocs;
+	uint32_t frees;
+	uint32_t failures; //allocations that found no free frame
+};
+
+struct HeapStats {
+	uint32_t largeAllocs; //kmalloc() requests served by frame runs
+	uint32_t largeFrames; //frames currently used by those requests
+	uint32_t slabFrames; //frames currently held by all caches
+	uint32_t slabBytesUsed; //bytes of objects in use in all caches
+};
+
+//sets up the kmalloc() size classes (pageFrame_init must be called first)
+void heap_init(void);
+
+//objectSize is rounded up to a multiple of 8. returns 0, or -1 (and the
+//cache is not created) if it exceeds HEAP_MAX_OBJECT_SIZE
+int heap_createCache(struct HeapCache *cache, const char *name, uint32_t objectSize);
+void *heap_cacheAlloc(struct HeapCache *cache);
+
+//first cache in the list of all caches, followed through cache->next
+struct HeapCache *heap_getCaches(void);
+void heap_getStats(struct HeapStats *stats);
+
+//returns 0 if no memory is left; kfree() also accepts objects allocated by
+//heap_cacheAlloc() and ignores null pointers
+void *kmalloc(size_t size);
+void kfree(void *ptr);
+
+#endif //HEAP_H
@@ -0,0 +1,99 @@
+/* J. Kent Wirant
+ * osmium
+ * hex_format.c
+ * Description: Table-driven conversion between bytes and hex text for the
+ *   memory editor. Each byte costs one table lookup instead of a loop with
+ *   a branch per digit.
+ */
+
+#include "hex_format.h"
+
+//both digits of every byte value; byte b is at hexPairs[2*b]
+#define HEX_PAIRS_16(hi) \
+	hi "0" hi "1" hi "2" hi "3" hi "4" hi "5" hi "6" hi "7" \
+	hi "8" hi "9" hi "A" hi "B" hi "C" hi "D" hi "E" hi "F"
+
+static const char hexPairs[] =
+	HEX_PAIRS_16("0") HEX_PAIRS_16("1") HEX_PAIRS_16("2") HEX_PAIRS_16("3")
+	HEX_PAIRS_16("4") HEX_PAIRS_16("5") HEX_PAIRS_16("6") HEX_PAIRS_16("7")
+	HEX_PAIRS_16("8") HEX_PAIRS_16("9") HEX_PAIRS_16("A") HEX_PAIRS_16("B")
+	HEX_PAIRS_16("C") HEX_PAIRS_16("D") HEX_PAIRS_16("E") HEX_PAIRS_16("F");
+
+//bit b is set if byte b is a displayable character (0x20 to 0x7E)
+static const uint32_t printableMask[8] = {
+	0x00000000, 0xFFFFFFFF, 0xFFFFFFFF, 0x7FFFFFFF,
+	0x00000000, 0x00000000, 0x00000000, 0x00000000
+};
+
+static const uint8_t digitValues[256] = {
+	[0 ... 255] = HEX_FORMAT_INVALID,
+	['0'] = 0x0, ['1'] = 0x1, ['2'] = 0x2, ['3'] = 0x3, ['4'] = 0x4,
+	['5'] = 0x5, ['6'] = 0x6, ['7'] = 0x7, ['8'] = 0x8, ['9'] = 0x9,
+	['A'] = 0xA, ['B'] = 0xB, ['C'] = 0xC, ['D'] = 0xD, ['E'] = 0xE, ['F'] = 0xF,
+	['a'] = 0xA, ['b'] = 0xB, ['c'] = 0xC, ['d'] = 0xD, ['e'] = 0xE, ['f'] = 0xF
+};
+
+void hexFormat_byte(char *dest, uint8_t value) {
+	const char *pair = &hexPairs[value * 2];
+	dest[0] = pair[0];
+	dest[1] = pair[1];
+}
+
+void hexFormat_row(char *line, uint32_t address, const uint8_t *bytes) {
+	uint8_t b;
+	
+	//address; the last digit is always 0, so it is shown as '_'
+	line[0] = ' ';
+	hexFormat_byte(&line[1], address >> 24);
+	hexFormat_byte(&line[3], address >> 16);
+	hexFormat_byte(&line[5], address >> 8);
+	hexFormat_byte(&line[7], address);
+	line[8] = '_';
+	line[9] = ' ';
+	line[10] = '|';
+	line[11] = ' ';
+	
+	for(int i = 0; i < HEX_FORMAT_ROW_BYTES; i++) {
+		b = bytes[i];
+		hexFormat_byte(&line[12 + 3 * i], b);
+		line[14 + 3 * i] = ' ';
+		line[62 + i] = ((printableMask[b >> 5] >> (b & 31)) & 1) ? b : '.';
+	}
+	
+	line[60] = '|';
+	line[61] = ' ';
+	line[78] = ' ';
+	line[79] = ' ';
+	line[80] = 0;
+}
+
+uint8_t hexFormat_digitValue(char c) {
+	return digitValues[(uint8_t) c];
+}
+
+int hexFormat_parse(uint8_t *dest, int max, const char *src, int n) {
+	int count = 0;
+	int i = 0;
+	uint8_t hi, lo;
+	
+	while(i < n && count < max) {
+		if(src[i] == ' ') {
+			i++;
+			continue;
+		}
+		
+		if(i + 1 >= n)
+			break;
+		
+		hi = digitValues[(uint8_t) src[i]];
+		lo = digitValues[(uint8_t) src[i + 1]];
+		
+		if((hi | lo) > 0x0F) //either digit invalid
+			break;
+		
+		dest[count++] = hi << 4 | lo;
+		i += 2;
+	}
+	
+	return count;
+}
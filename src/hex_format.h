@@ -0,0 +1,35 @@
+/* J. Kent Wirant
+ * osmium
+ * hex_format.h
+ * Description: Table-driven conversion between bytes and hex text for the
+ *   memory editor. Each byte costs one table lookup instead of a loop with
+ *   a branch per digit.
+ */
+
+#ifndef HEX_FORMAT_H
+#define HEX_FORMAT_H
+
+#include <stdint.h>
+
+#define HEX_FORMAT_ROW_BYTES 16
+#define HEX_FORMAT_LINE_LENGTH 80 //characters, not counting the null
+
+//returned by hexFormat_digitValue() for characters that are not hex digits
+#define HEX_FORMAT_INVALID 0xFF
+
+//writes the two hex digits of value to dest (no null character)
+void hexFormat_byte(char *dest, uint8_t value);
+
+//formats one 16-byte row as shown by the editor:
+//" AAAAAAA_ | ## ## ... ## | ascii...........  " (80 characters + null)
+void hexFormat_row(char *line, uint32_t address, const uint8_t *bytes);
+
+//value of a hex digit (either case), or HEX_FORMAT_INVALID
+uint8_t hexFormat_digitValue(char c);
+
+//parses up to max bytes from n characters of pairs of hex digits; spaces
+//between pairs are skipped. Stops at the first invalid character or at an
+//unpaired digit. Returns the number of bytes written to dest.
+int hexFormat_parse(uint8_t *dest, int max, const char *src, int n);
+
+#endif //HEX_FORMAT_H
@@ -19,113 +19,149 @@ typedef unsigned long int size_t;
 #include "isr.h"
 #include "keyboard.h"
 #include "driver_pci.h"
+#include "mem_view.h"
+#include "hex_format.h"
+#include "boot_info.h"
+#include "memory_map.h"
+#include "page_frame.h"
+#include "heap.h"
+#include "paging.h"
+#include "timer.h"
+#include "acpi.h"
+#include "apic.h"
+#include "event.h"
+#include "exceptions.h"
+#include "serial.h"
+#include "console.h"
+#include "x86_util.h"
 
-#define TERMINAL_ROWS 16 //16 rows of 16 bytes
+#define TERMINAL_ROWS MEM_VIEW_ROWS
 
 int cursorRow = 0; //32 columns to account for 2 hex digits per byte
 int cursorCol = 0;
 
-uint8_t hexBuffer[TERMINAL_ROWS * 16 * 2 + 1]; //account for null space
-uint8_t asciiBuffer[TERMINAL_ROWS * 16 + 1]; //account for null space
 uint8_t commandBuffer[32 + 1]; //account for null space
 uint8_t statusBuffer[32 + 1]; //account for null space
 uint8_t extraBuffer[80*4 + 1]; //account for null space
 uint8_t selectedBuffer = 0; //0 for hex, 1 for ascii, 2 for command
 
-uint32_t memLocation = 0x7000;
+//screen layout (rows)
+#define SCREEN_ROW_MEMORY 3 //first row of the memory view
+#define SCREEN_ROW_EXTRA (SCREEN_ROW_MEMORY + TERMINAL_ROWS)
+#define SCREEN_ROW_HELP 23
+#define SCREEN_ROW_COMMAND 24
 
+//bit n is set if screen row n must be formatted again by updateDisplay()
+uint32_t redrawRows = 0xFFFFFFFF;
+
+void markRowsForRedraw(int firstRow, int count) {
+	for(int i = firstRow; i < firstRow + count; i++) {
+		redrawRows |= 1UL << i;
+	}
+}
+
+//takes a mask of memory view rows, as from memView_takeChangedRows()
+void markMemoryRowsChanged(uint32_t rowMask) {
+	redrawRows |= rowMask << SCREEN_ROW_MEMORY;
+}
+
+//shifts the rows already on screen so only the exposed rows are formatted
+void scrollMemoryView(int rows) {
+	memView_scroll(rows);
+	scrollRows(SCREEN_ROW_MEMORY, TERMINAL_ROWS, rows);
+}
+
+void drawLine(int row, const char *line) {
+	setCursorPosition(row, 0);
+	printRaw(line);
+}
+
+void drawMemoryRow(int i) {
+	char line[HEX_FORMAT_LINE_LENGTH + 1];
+	hexFormat_row(line, memView_getBase() + i * 16, memView_getRow(i));
+	drawLine(SCREEN_ROW_MEMORY + i, line);
+}
+
+//formats only the rows marked by markRowsForRedraw(); flushDisplay() then
+//writes only the cells that differ from what is already on screen.
 void updateDisplay(void) {
-	//write header to display
-	setCursorPosition(0, 0);
 	char line[81];
 	line[80] = 0;
-	uint32_t memData;
-	uint32_t memRow = memLocation & ~0xF;
 	
 	//line 1
-	for(int i = 0; i < 80; i++) {
-		line[i] = ' ';
+	if(redrawRows & (1UL << 0)) {
+		for(int i = 0; i < 80; i++) {
+			line[i] = ' ';
+		}
+		strncpy_safe(line, "Press ESC to enter a command.", 29);
+		drawLine(0, line);
 	}
-	strncpy_safe(line, "Press ESC to enter a command.", 29);
-	printRaw(line); //line 1
 	
 	//line 2
-	strncpy_safe(line, " Address  | ", 12);
-	for(int i = 0; i < 16; i++) {
-		line[12 + i * 3] = '_';
-		intToHexStr(&line[13 + i * 3], i, 1);
-		line[14 + i * 3] = ' ';
+	if(redrawRows & (1UL << 1)) {
+		strncpy_safe(line, " Address  | ", 12);
+		for(int i = 0; i < 16; i++) {
+			line[12 + i * 3] = '_';
+			intToHexStr(&line[13 + i * 3], i, 1);
+			line[14 + i * 3] = ' ';
+		}
+		strncpy_safe(&line[60], "| 0123456789ABCDEF  ", 20);
+		drawLine(1, line);
 	}
-	strncpy_safe(&line[60], "| 0123456789ABCDEF  ", 20);
-	printRaw(line);
 	
 	//line 3
-	for(int i = 0; i < 80; i++) {
-		line[i] = '_';
+	if(redrawRows & (1UL << 2)) {
+		for(int i = 0; i < 80; i++) {
+			line[i] = '_';
+		}
+		drawLine(2, line);
 	}
-	printRaw(line);
 	
 	//lines 4 to (3+TERMINAL_ROWS)
+	markMemoryRowsChanged(memView_takeChangedRows());
+	
 	for(int i = 0; i < TERMINAL_ROWS; i++) {
-		line[0] = ' ';
-		intToHexStr(&line[1], memRow + i * 16, 8);
-		strncpy_safe(&line[8], "_ | ", 4);
-		
-		for(int j = 0; j < 4; j++) {
-			memData = *((uint32_t *)(memRow + i * 16 + j * 4));
-			
-			for(int k = 0; k < 4; k++) {
-				//hex portion of display
-				intToHexStr(&line[12 + 3 * (j * 4 + k)], memData, 2);
-				line[14 + 3 * (j * 4 + k)] = ' ';
-								
-				//ascii portion of display
-				if((memData & 0xFF) >= 0x20 && (memData & 0xFF) < 0x7F) {
-					line[62 + j * 4 + k] = memData & 0xFF;
-				}
-				else {
-					line[62 + j * 4 + k] = '.'; //filler character
-				}
-				
-				memData >>= 8;
-			}
+		if(redrawRows & (1UL << (SCREEN_ROW_MEMORY + i))) {
+			drawMemoryRow(i);
 		}
-		
-		line[60] = '|';
-		line[61] = ' ';
-		line[78] = ' ';
-		line[79] = ' ';	
-		printRaw(line);
 	}
 	
 	//lines (4+TERMINAL_ROWS) to 23
 	for(int i = 0; i < 4; i++) {
-		strncpy_safe(line, &extraBuffer[i*80], 80);
-		printRaw(line);
+		if(redrawRows & (1UL << (SCREEN_ROW_EXTRA + i))) {
+			strncpy_safe(line, &extraBuffer[i*80], 80);
+			drawLine(SCREEN_ROW_EXTRA + i, line);
+		}
 	}
 
 	//line 24
-	strncpy_safe(line, " Commands: goto <addr16>; call <addr16>; pciEnum <addr16> <count10>", 67);
-	for(int i = 67; i < 80; i++) {
-		line[i] = ' ';
+	if(redrawRows & (1UL << SCREEN_ROW_HELP)) {
+		strncpy_safe(line, " Commands: goto <addr16>; call <addr16>; refresh; help (lists all)", 66);
+		for(int i = 66; i < 80; i++) {
+			line[i] = ' ';
+		}
+		drawLine(SCREEN_ROW_HELP, line);
 	}
-	printRaw(line);
 
 	//line 25
-	line[0] = '>';
-	line[1] = ' ';
-	
-	for(int i = 2; i < 80; i++) {
-		line[i] = ' ';
+	if(redrawRows & (1UL << SCREEN_ROW_COMMAND)) {
+		line[0] = '>';
+		line[1] = ' ';
+		
+		for(int i = 2; i < 80; i++) {
+			line[i] = ' ';
+		}
+		
+		strncpy_safe(&line[2], commandBuffer, 32);
+		strncpy_safe(&line[46], statusBuffer, 32);
+		drawLine(SCREEN_ROW_COMMAND, line);
 	}
 	
-	strncpy_safe(&line[2], commandBuffer, 32);
-	strncpy_safe(&line[46], statusBuffer, 32);
-	printRaw(line);
+	redrawRows = 0;
 	
 	//convert cursor position to screen coordinates
-	char row = cursorRow + 3;
-	char col;
+	char row = cursorRow + SCREEN_ROW_MEMORY;
+	char col = 0;
 	
 	if(selectedBuffer == 0) { //hex: formatted as "## ## ## ..."
 		col = 12 + cursorCol / 2 * 3 + (cursorCol & 1);
@@ -135,29 +171,200 @@ void updateDisplay(void) {
 	}
 	else if(selectedBuffer == 2) { //command buffer
 		col = 2 + cursorCol;
-		row = 24;
+		row = SCREEN_ROW_COMMAND;
 	}
 	
 	highlight(row, col);
+	flushDisplay();
 }
 
-void updateMemory(void) {
-	//The terminal program runs in the address range of
-	//0x7800 to 0xB800. It has been made read-only to avoid 
-	//unintentional writes from viewing the range.
-	//if(memLocation >= 0x7800 && memLocation < 0xB800)
-	//	return;
-	
-	if(selectedBuffer == 0) { //hex buffer
-		for(int i = 0; i < 16 * TERMINAL_ROWS; i++) {
-			((uint8_t *)memLocation)[i] = hexStrToInt(&hexBuffer[i*2], 2);
-		}
+void clearExtraLines(void) {
+	for(int i = 0; i < 320; i++) {
+		extraBuffer[i] = ' ';
 	}
-	else if(selectedBuffer == 1) { //ascii buffer
-		//update only one row 
-		for(int i = 0; i < 16 * TERMINAL_ROWS; i++) {
-			((uint8_t *)memLocation)[i] = asciiBuffer[i];
-		}
+}
+
+//lists the memory map in the extra lines, three regions per line:
+//"BBBBBBBBBB-EEEEEEEEEE T" with base, end and type (first letter)
+void showMemoryMap(void) {
+	const char *typeNames = "?URANB"; //unknown, usable, reserved, ACPI, NVS, bad
+	const struct MemoryRegion *regions;
+	uint32_t count;
+	char *dest;
+	char tmp[6];
+	
+	regions = memoryMap_getRegions(&count);
+	clearExtraLines();
+	
+	for(uint32_t i = 0; i < count && i < 12; i++) {
+		dest = &extraBuffer[(i / 3) * 80 + (i % 3) * 26 + 1];
+		intToHexStr(dest, regions[i].base >> 32, 2);
+		intToHexStr(dest + 2, regions[i].base, 8);
+		dest[10] = '-';
+		intToHexStr(dest + 11, regions[i].end >> 32, 2);
+		intToHexStr(dest + 13, regions[i].end, 8);
+		dest[21] = ' ';
+		dest[22] = typeNames[regions[i].type <= MEMORY_BAD ? regions[i].type : 0];
+	}
+	
+	intToDecStr(tmp, memoryMap_getUsableBytes() >> 20, 5);
+	strncpy_safe(statusBuffer, "[memMap: ", 9);
+	strncpy_safe(statusBuffer + 9, tmp, 5);
+	strncpy_safe(statusBuffer + 14, " MiB usable]", 12);
+}
+
+//lists the functions found at boot from the PCI registry, three per line:
+//bus:device.function vendor:device class.subclass.progIf. an optional
+//hex argument is the first entry shown.
+void showPciDevices(void) {
+	uint16_t count = pciGetDeviceCount();
+	uint16_t first = 0;
+	int argOffset = 7;
+	int argLength = 0;
+	char tmp[6];
+	
+	while(commandBuffer[argOffset] == ' ' && argOffset < 32) argOffset++;
+	while(argOffset + argLength < 32 && hexFormat_digitValue(commandBuffer[argOffset + argLength])
+	  != HEX_FORMAT_INVALID) argLength++;
+	if(argLength > 0 && argLength <= 4)
+		first = hexStrToInt((char *) &commandBuffer[argOffset], argLength);
+	
+	clearExtraLines();
+	
+	for(int i = 0; i < 12 && first + i < count; i++) {
+		const struct PciDevice *dev = pciGetDevice(first + i);
+		char *entry = (char *) &extraBuffer[(i / 3) * 80 + (i % 3) * 27];
+		
+		intToHexStr(entry, dev->bus, 2);
+		entry[2] = ':';
+		intToHexStr(&entry[3], dev->device, 2);
+		entry[5] = '.';
+		intToHexStr(&entry[6], dev->function, 1);
+		entry[7] = ' ';
+		intToHexStr(&entry[8], dev->table.vendorId, 4);
+		entry[12] = ':';
+		intToHexStr(&entry[13], dev->table.deviceId, 4);
+		entry[17] = ' ';
+		intToHexStr(&entry[18], dev->table.classCode, 2);
+		entry[20] = '.';
+		intToHexStr(&entry[21], dev->table.subclass, 2);
+		entry[23] = '.';
+		
+		//the third entry ends at column 79; its terminator must not land
+		//on the next line
+		intToHexStr(tmp, dev->table.progIf, 2);
+		entry[24] = tmp[0];
+		entry[25] = tmp[1];
+		if(i % 3 != 2) entry[26] = ' ';
+	}
+	
+	intToDecStr(tmp, count, 5);
+	strncpy_safe(statusBuffer, "[pciList: ", 10);
+	strncpy_safe(statusBuffer + 10, tmp, 5);
+	strncpy_safe(statusBuffer + 15, " functions]", 11);
+}
+
+//shows free frames and the number of free runs of each order; a high
+//fragmentation means large contiguous allocations may fail
+void showMemoryStats(void) {
+	struct PageFrameStats stats;
+	char tmp[11];
+	char *dest;
+	
+	pageFrame_getStats(&stats);
+	clearExtraLines();
+	
+	intToDecStr(tmp, stats.totalFrames, 7);
+	strncpy_safe(&extraBuffer[1], "frames: ", 8);
+	strncpy_safe(&extraBuffer[9], tmp, 7);
+	strncpy_safe(&extraBuffer[16], " total, ", 8);
+	intToDecStr(tmp, stats.freeFrames, 7);
+	strncpy_safe(&extraBuffer[24], tmp, 7);
+	strncpy_safe(&extraBuffer[31], " free; fragmentation ", 21);
+	intToDecStr(tmp, stats.fragmentation, 3);
+	strncpy_safe(&extraBuffer[52], tmp, 3);
+	extraBuffer[55] = '%';
+	
+	//"2^N:nnnnnnn" for each order, six per line
+	for(uint32_t i = 0; i <= PAGE_FRAME_MAX_ORDER; i++) {
+		dest = &extraBuffer[(1 + i / 6) * 80 + (i % 6) * 13 + 1];
+		dest[0] = '2';
+		dest[1] = '^';
+		intToDecStr(tmp, i, 2);
+		strncpy_safe(dest + 2, tmp, 2);
+		dest[4] = ':';
+		intToDecStr(tmp, stats.freeBlocks[i], 7);
+		strncpy_safe(dest + 5, tmp, 7);
+	}
+	
+	intToDecStr(tmp, stats.freeFrames >> 8, 5);
+	strncpy_safe(statusBuffer, "[memStat: ", 10);
+	strncpy_safe(statusBuffer + 10, tmp, 5);
+	strncpy_safe(statusBuffer + 15, " MiB free]", 10);
+}
+
+//shows objects in use / capacity and frames held for up to eight caches:
+//"name         uuuuu/ccccc fffffp"
+void showHeapStats(void) {
+	struct HeapStats stats;
+	struct HeapCache *cache = heap_getCaches();
+	char tmp[6];
+	char *dest;
+	
+	clearExtraLines();
+	
+	for(int i = 0; i < 8 && cache; i++, cache = cache->next) {
+		dest = &extraBuffer[(i / 2) * 80 + (i % 2) * 40 + 1];
+		strncpy_safe(dest, cache->name, 12);
+		for(int j = strlen(cache->name); j < 12; j++) dest[j] = ' ';
+		
+		intToDecStr(tmp, cache->inUse, 5);
+		strncpy_safe(dest + 13, tmp, 5);
+		dest[18] = '/';
+		intToDecStr(tmp, cache->slabs * cache->objectsPerSlab, 5);
+		strncpy_safe(dest + 19, tmp, 5);
+		dest[24] = ' ';
+		intToDecStr(tmp, cache->slabs, 5);
+		strncpy_safe(dest + 25, tmp, 5);
+		dest[30] = 'p';
+	}
+	
+	heap_getStats(&stats);
+	strncpy_safe(statusBuffer, "[heap: ", 7);
+	intToDecStr(tmp, stats.slabFrames * 4, 5);
+	strncpy_safe(statusBuffer + 7, tmp, 5);
+	strncpy_safe(statusBuffer + 12, "K slab ", 7);
+	intToDecStr(tmp, stats.largeFrames * 4, 5);
+	strncpy_safe(statusBuffer + 19, tmp, 5);
+	strncpy_safe(statusBuffer + 24, "K large]", 8);
+}
+
+//writes text to the serial console without trailing spaces
+static void mirrorLine(const char *text, int length) {
+	char line[81];
+	
+	//the buffers may hold terminators left by strncpy_safe()
+	for(int i = 0; i < length && i < 80; i++) {
+		line[i] = text[i] ? text[i] : ' ';
+	}
+	
+	while(length > 0 && line[length - 1] == ' ') {
+		length--;
+	}
+	
+	if(length > 0) {
+		line[length] = '\n';
+		console_writeN(line, length + 1);
+	}
+}
+
+//copies the result of a command (status and extra lines) to the serial
+//console, so the shell can be used without a screen
+void mirrorCommandOutput(void) {
+	mirrorLine(statusBuffer, 32);
+	
+	for(int i = 0; i < 4; i++) {
+		mirrorLine(&extraBuffer[i * 80], 80);
 	}
 }
 
@@ -167,12 +374,10 @@ void processCommand(void) {
 	int address;
 	int addressOffset;
 	int addressLength;
-	int arg;
-	int argOffset;
-	int argLength;
 	uint8_t shouldParseAddress = 0;
 	uint8_t commandId = 0;
 	uint8_t isGood = 1;
+	uint8_t shouldRefresh = 0; //the command may have changed memory
 	
 	//clear status buffer
 	for(int i = 0; i < 32; i++) {
@@ -194,9 +399,29 @@ void processCommand(void) {
 		commandId = 2;
 		shouldParseAddress = 1;
 	}
-	else if(strncmp(commandBuffer, "pciEnum", cmpLength) == 0) {
-		commandId = 3;
-		shouldParseAddress = 1;
+	else if(strncmp(commandBuffer, "refresh", cmpLength) == 0) {
+		commandId = 4;
+	}
+	else if(strncmp(commandBuffer, "memMap", cmpLength) == 0) {
+		commandId = 5;
+	}
+	else if(strncmp(commandBuffer, "help", cmpLength) == 0) {
+		commandId = 6;
+	}
+	else if(strncmp(commandBuffer, "memStat", cmpLength) == 0) {
+		commandId = 7;
+	}
+	else if(strncmp(commandBuffer, "heapStat", cmpLength) == 0) {
+		commandId = 8;
+	}
+	else if(strncmp(commandBuffer, "uptime", cmpLength) == 0) {
+		commandId = 9;
+	}
+	else if(strncmp(commandBuffer, "idle", cmpLength) == 0) {
+		commandId = 10;
+	}
+	else if(strncmp(commandBuffer, "pciList", cmpLength) == 0) {
+		commandId = 11;
 	}
 	
 	if(shouldParseAddress) {
@@ -232,59 +457,68 @@ void processCommand(void) {
 	if(isGood) {
 		if(commandId == 1) { //goto
 			strncpy_safe(statusBuffer, "[goto successful]", 17);
-			memLocation = address;
+			memView_setBase(address);
 		}
 		else if(commandId == 2) {
 			strncpy_safe(statusBuffer, "[call successful]", 17);
 			((void (*)(void))address)();
+			shouldRefresh = 1;
 		}
-		else if(commandId == 3) {
-			//bypass spaces
-			while(commandBuffer[commandLength] <= 0x20 && commandLength < 32) {
-				commandLength++;
-			}
-			
-			//start of 1st argument
-			argOffset = commandLength;
+		else if(commandId == 4) {
+			strncpy_safe(statusBuffer, "[refresh successful]", 20);
+			shouldRefresh = 1;
+		}
+		else if(commandId == 5) {
+			showMemoryMap();
+		}
+		else if(commandId == 6) {
+			clearExtraLines();
+			strncpy_safe(&extraBuffer[0*80], " goto <addr16>: view memory; call <addr16>: run code at address; uptime; idle", 77);
+			strncpy_safe(&extraBuffer[1*80], " pciList <first16>: list PCI functions; refresh: re-read memory view", 68);
+			strncpy_safe(&extraBuffer[2*80], " memMap: physical memory map; memStat: free page frames; heapStat: slab caches", 78);
+			strncpy_safe(statusBuffer, "[help]", 6);
+		}
+		else if(commandId == 7) {
+			showMemoryStats();
+		}
+		else if(commandId == 8) {
+			showHeapStats();
+		}
+		else if(commandId == 9) {
+			char tmp[6];
 			
-			//get number of decimal digits
-			while(commandBuffer[commandLength] >= '0' &&
-			  commandBuffer[commandLength] <= '9' &&
-			  commandLength < 32) {
-				commandLength++;
-			}
+			intToDecStr(tmp, timer_nowMs() / 1000, 5);
+			strncpy_safe(statusBuffer, "[uptime: ", 9);
+			strncpy_safe(statusBuffer + 9, tmp, 5);
+			strncpy_safe(statusBuffer + 14, "s tsc ", 6);
+			intToDecStr(tmp, timer_getTscKHz() / 1000, 5);
+			strncpy_safe(statusBuffer + 20, tmp, 5);
+			strncpy_safe(statusBuffer + 25, " MHz]", 5);
+		}
+		else if(commandId == 10) {
+			struct IdleStats stats;
+			char tmp[11];
 			
-			argLength = commandLength - argOffset;
+			event_getIdleStats(&stats);
+			intToDecStr(tmp, stats.percentIdle, 3);
+			strncpy_safe(statusBuffer, "[idle: ", 7);
+			strncpy_safe(statusBuffer + 7, tmp, 3);
+			strncpy_safe(statusBuffer + 10, stats.usesMwait ? "% (mwait)]" : "% (hlt)]", 10);
 			
-			//invalid literal
-			if(argLength == 0 || commandBuffer[commandLength] > 0x20) {
-				strncpy_safe(statusBuffer, "[Invalid args; must be base 10]", 31);
-				isGood = 0;
-			}
-			else { //parse decimal
-				arg = decStrToInt(&commandBuffer[argOffset], argLength);
-			}
-
-			if(isGood) {
-				int numFn = pciEnumerate((uint16_t *) address, arg);
-
-				char tmp[6];
-				intToDecStr(tmp, numFn, 5);
-
-				strncpy_safe(statusBuffer, "[pciEnum successful (", 21);
-				strncpy_safe(statusBuffer + 21, tmp, 5);
-				strncpy_safe(statusBuffer + 26, ")]", 2);
-
-				//temporary tests
-				intToHexStr(extraBuffer, pciConfigReadInt8(0, 0, 0, PCI_HDR_VENDOR_ID), 2);
-				extraBuffer[2] = ' ';
-				intToHexStr(&extraBuffer[3], pciConfigReadInt16(0, 0, 0, PCI_HDR_VENDOR_ID), 4);
-				extraBuffer[7] = ' ';
-				intToHexStr(&extraBuffer[8], pciConfigReadInt16(0, 0, 0, PCI_HDR_REVISION_ID), 8);
-				extraBuffer[16] = ' ';
-
-				//end of tests
-			}
+			clearExtraLines();
+			strncpy_safe(&extraBuffer[1], "wakeups: ", 9);
+			intToDecStr(tmp, stats.wakeups, 10);
+			strncpy_safe(&extraBuffer[10], tmp, 10);
+			strncpy_safe(&extraBuffer[20], "; idle ms: ", 11);
+			intToDecStr(tmp, timer_usToMs(stats.idleUs), 10);
+			strncpy_safe(&extraBuffer[31], tmp, 10);
+			strncpy_safe(&extraBuffer[41], " of ", 4);
+			intToDecStr(tmp, timer_usToMs(stats.totalUs), 10);
+			strncpy_safe(&extraBuffer[45], tmp, 10);
+			extraBuffer[55] = ' ';
+		}
+		else if(commandId == 11) {
+			showPciDevices();
 		}
 		else {
 			strncpy_safe(statusBuffer, "[Invalid command.]", 18);
@@ -296,19 +530,83 @@ void processCommand(void) {
 		commandBuffer[i] = ' ';
 		cursorCol = 0; //reset cursor
 	}
+	
+	//the window is re-read only when asked or after a command that writes
+	//memory, since reading device memory may have side effects; only rows
+	//whose bytes differ are formatted again
+	if(shouldRefresh)
+		memView_refresh();
+	markRowsForRedraw(SCREEN_ROW_EXTRA, SCREEN_ROW_COMMAND + 1 - SCREEN_ROW_EXTRA);
+	mirrorCommandOutput();
 }
 
-void keyboardHandler(uint8_t c, uint8_t keyCode, uint16_t flags) {
+//runs a line typed on the serial console; the keyboard's partly typed
+//command is kept
+void serialLineHandler(const char *line) {
+	char savedCommand[32];
+	int savedCol = cursorCol;
+	int i;
 	
-	//ensure memory-buffer coherency
-	uint8_t memData;
-		
-	for(int i = 0; i < 16 * TERMINAL_ROWS; i++) {
-		memData = ((uint8_t *)memLocation)[i];
-		intToHexStr(&hexBuffer[i*2], memData, 2);
-		asciiBuffer[i] = memData;
+	for(i = 0; i < 32; i++) {
+		savedCommand[i] = commandBuffer[i];
 	}
 	
+	for(i = 0; i < 32 && line[i]; i++) {
+		commandBuffer[i] = line[i];
+	}
+	for(; i < 32; i++) {
+		commandBuffer[i] = ' ';
+	}
+	
+	processCommand();
+	
+	for(i = 0; i < 32; i++) {
+		commandBuffer[i] = savedCommand[i];
+	}
+	cursorCol = savedCol;
+	markRowsForRedraw(SCREEN_ROW_COMMAND, 1);
+}
+
+//the shell resumes here after an exception (e.g. "call" to a bad address)
+static jmp_buf shellRecovery;
+
+//shows the dump in the extra lines and discards the command that failed
+void showException(int vector) {
+	const char *dump = exceptions_getDump();
+	char tmp[3];
+	
+	for(int i = 0; i < 320; i++) {
+		extraBuffer[i] = dump[i];
+	}
+	
+	for(int i = 0; i < 32; i++) {
+		commandBuffer[i] = ' ';
+		statusBuffer[i] = ' ';
+	}
+	
+	cursorCol = 0;
+	intToDecStr(tmp, vector, 2);
+	strncpy_safe(statusBuffer, "[exception ", 11);
+	strncpy_safe(statusBuffer + 11, tmp, 2);
+	strncpy_safe(statusBuffer + 13, "; shell restarted]", 18);
+	
+	memView_refresh();
+	markRowsForRedraw(0, SCREEN_ROW_COMMAND + 1);
+	
+	//the dump itself was already written to COM1
+	mirrorLine(statusBuffer, 32);
+	console_write("> ");
+}
+
+//a held arrow key arrives as one event, so the cursor moves key->count
+//steps and the view is scrolled and redrawn once
+void keyboardHandler(const struct KeyEvent *key) {
+	uint8_t c = key->c;
+	int steps = key->count;
+	
+	//memory is not re-read here; the view only re-reads bytes it writes.
+	//use the refresh command to see changes made by devices.
+	
 	//change cursor if an arrow key was pressed OR enter command
 	
 	if(c == 0x1B) { //select command buffer
@@ -318,35 +616,34 @@ void keyboardHandler(uint8_t c, uint8_t keyCode, uint16_t flags) {
 		cursorRow = 0;
 	}
 	else if(c == '\n' && selectedBuffer == 2) { //command entered
+		mirrorLine(commandBuffer, 32); //echo on the serial console
 		processCommand();
+		console_write("> ");
 	}
-	else if(c == 0x81) { //up arrow
+	else if(c == KEY_UP) {
 		cursorCol &= ~1; //first hex digit, if applicable
-		cursorRow--;
+		cursorRow -= steps;
 	}
-	else if(c == 0x83) { //left arrow
+	else if(c == KEY_LEFT) {
 		cursorCol &= ~1; //first hex digit, if applicable
-		cursorCol -= 2; //move by byte position
+		cursorCol -= 2 * steps; //move by byte position
 	}
-	else if(c == 0x84) { //right arrow
+	else if(c == KEY_RIGHT) {
 		cursorCol &= ~1; //first hex digit, if applicable 
-		cursorCol += 2; //move by byte position
+		cursorCol += 2 * steps; //move by byte position
 	}
-	else if(c == 0x86) { //down arrow
+	else if(c == KEY_DOWN) {
 		cursorCol &= ~1; //first hex digit, if applicable
-		cursorRow++;
+		cursorRow += steps;
 	}
 	else { //type a character
 		if(selectedBuffer == 0) { //typed in hex buffer
 			//hex chars only
-			if(c >= '0' && c <= '9') {
-				hexBuffer[32*cursorRow + cursorCol] = c;
-				updateMemory();
-				cursorCol++;
-			}
-			else if((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
-				hexBuffer[32*cursorRow + cursorCol] = c & ~0x20;
-				updateMemory();
+			uint8_t digit = hexFormat_digitValue(c);
+			
+			if(digit != HEX_FORMAT_INVALID) {
+				memView_writeNibble(16*cursorRow + cursorCol/2, 
+				  (cursorCol & 1) == 0, digit);
 				cursorCol++;
 			}
 			
@@ -359,8 +656,7 @@ void keyboardHandler(uint8_t c, uint8_t keyCode, uint16_t flags) {
 		else if(selectedBuffer == 1) { //typed in ascii buffer
 			//any displayable character
 			if(c >= 0x20 && c < 0x7F) {
-				asciiBuffer[16*cursorRow + cursorCol/2] = c;
-				updateMemory();
+				memView_writeByte(16*cursorRow + cursorCol/2, c);
 				cursorCol &= ~1; //should be even index for ascii buffer
 				cursorCol += 2; //move by byte position
 			}
@@ -374,6 +670,7 @@ void keyboardHandler(uint8_t c, uint8_t keyCode, uint16_t flags) {
 			//any displayable character
 			if(c >= 0x20 && c < 0x7F) {
 				commandBuffer[cursorCol] = c;
+				markRowsForRedraw(SCREEN_ROW_COMMAND, 1);
 				cursorCol++;
 			}
 		}
@@ -381,11 +678,11 @@ void keyboardHandler(uint8_t c, uint8_t keyCode, uint16_t flags) {
 	
 	//handle cursor out of bounds
 	if(cursorRow >= TERMINAL_ROWS) { //scroll down
-		memLocation += 16;
+		scrollMemoryView(cursorRow - (TERMINAL_ROWS - 1));
 		cursorRow = TERMINAL_ROWS - 1;
 	}
 	else if(cursorRow < 0) { //scroll up
-		memLocation -= 16;
+		scrollMemoryView(cursorRow);
 		cursorRow = 0;
 	}
 	else if(cursorCol < 0) { //switch to hex or don't move
@@ -410,23 +707,84 @@ void keyboardHandler(uint8_t c, uint8_t keyCode, uint16_t flags) {
 		}
 	}
 	
-	updateDisplay();
+	//the display is updated by the main loop once per batch of keys
 }
 
 //entry point from bootloader
-void _start(void) {
-	clearScreen();
+void _start(struct BootInfo *bootInfo) {
+	struct KeyEvent keys[16];
+	int vector;
+	
+	serial_init();
+	
+	//faults in the setup below are dumped instead of triple faulting
+	setInterruptDescriptor(isr_timer, 0x20, 0);
 	setInterruptDescriptor(isr_keyboard, 0x21, 0);
+	setInterruptDescriptor(isr_serial, 0x24, 0);
+	setInterruptDescriptor(isr_spurious, APIC_SPURIOUS_VECTOR, 0);
+	//the 8259s can raise spurious IRQs 7 and 15 even when masked
+	setInterruptDescriptor(isr_spurious, IRQ_VECTOR_BASE + 7, 0);
+	setInterruptDescriptor(isr_spuriousSecondary, IRQ_VECTOR_BASE + 15, 0);
+	exceptions_init();
 	loadIdt();
+	
+	memoryMap_init(bootInfo);
+	pageFrame_init();
+	paging_init();
+	heap_init();
+	acpi_init();
+	pciInit();
+	pciRegistryInit();
+	clearScreen();
 	pic_init();
-	keyboard_init(keyboardHandler);
+	x86_enableInterrupts(); //every IRQ line is masked until its driver starts
+	timer_init();
+	keyboard_init(0); //keys are read in batches by the main loop
+	
+	//fastest repeat after a 500 ms delay: with arrow keys coalesced, a
+	//held key scrolls the memory view at 30 rows/s without falling behind
+	keyboard_queueCommand(CMD_SET_TYPEMATIC, KEYBOARD_TYPEMATIC(0, 1));
+	serial_enableInterrupts();
+	console_init(serialLineHandler);
 	strncpy_safe(statusBuffer, "[J. Kent Wirant, 2022]", 22);
+	if(keyboard_getControllerStatus() != 0)
+		strncpy_safe(statusBuffer, "[PS/2 controller test failed]", 29);
 	
-	for(int i = 0; i < 320; i++) {
-		extraBuffer[i] = ' ';
-	}
-
+	clearExtraLines();
 	extraBuffer[320] = 0;
+	memView_setBase(0x7000);
 	updateDisplay();
-	while(1); //hang
+	
+	//exceptions arrive with interrupts disabled and the stack abandoned
+	vector = setjmp(shellRecovery);
+	if(vector) {
+		showException(vector - 1);
+		x86_enableInterrupts();
+		updateDisplay();
+	}
+	exceptions_setRecovery(&shellRecovery);
+	
+	//main loop: sleeps until an interrupt posts an event. keys that
+	//arrived since the last pass are handled as one batch and the screen
+	//is drawn once for all of them.
+	while(1) {
+		uint32_t events = event_wait();
+		int changed = 0;
+		
+		if(events & EVENT_KEYBOARD) {
+			uint32_t count;
+			
+			while((count = keyboard_readBatch(keys, 16)) > 0) {
+				for(uint32_t i = 0; i < count; i++) {
+					keyboardHandler(&keys[i]);
+				}
+				changed = 1;
+			}
+		}
+		if(events & EVENT_SERIAL)
+			changed |= console_processInput() > 0;
+		
+		if(changed)
+			updateDisplay();
+	}
 }
@@ -8,6 +8,7 @@
 
 #include "interrupts.h"
 #include "x86_util.h"
+#include "apic.h"
 
 #define PIC0_CMD_STAT 0x20 //primary PIC command/status I/O port
 #define PIC0_IMR_DATA 0x21 //primary interrupt mask register/data register
@@ -44,6 +45,46 @@ void setInterruptDescriptor(void (*isr)(struct interrupt_frame *),
 	entry->reserved = 0;
 }
 
+//one bit per vector in the dynamic range
+static uint32_t usedVectors[(DYNAMIC_VECTOR_END - DYNAMIC_VECTOR_BASE + 31) / 32];
+
+static int vectorUsed(int vector) {
+	int i = vector - DYNAMIC_VECTOR_BASE;
+	return (usedVectors[i >> 5] >> (i & 31)) & 1;
+}
+
+int allocInterruptVectors(uint8_t count, uint8_t align) {
+	int first;
+	
+	if(count == 0 || align == 0 || (align & (align - 1)) != 0)
+		return -1;
+	
+	//DYNAMIC_VECTOR_BASE is aligned to 16, so larger blocks start above it
+	first = (DYNAMIC_VECTOR_BASE + align - 1) & ~(align - 1);
+	
+	for(int vector = first; vector + count <= DYNAMIC_VECTOR_END; vector += align) {
+		int n = 0;
+		while(n < count && !vectorUsed(vector + n)) n++;
+		if(n < count) continue;
+		
+		for(n = 0; n < count; n++) {
+			int i = vector + n - DYNAMIC_VECTOR_BASE;
+			usedVectors[i >> 5] |= 1UL << (i & 31);
+		}
+		return vector;
+	}
+	
+	return -1;
+}
+
+void freeInterruptVectors(uint8_t vector, uint8_t count) {
+	for(int n = 0; n < count; n++) {
+		int i = vector + n - DYNAMIC_VECTOR_BASE;
+		if(i >= 0 && vector + n < DYNAMIC_VECTOR_END)
+			usedVectors[i >> 5] &= ~(1UL << (i & 31));
+	}
+}
+
 void loadIdt(void) {
 	idtd.size = 256 * 8 - 1;
 	idtd.offset0 = (uint32_t) &IDT & 0x0000FFFF;
@@ -53,12 +94,11 @@ void loadIdt(void) {
 }
 
 //source: http://www.brokenthorn.com/Resources/OSDevPic.html
+//the 8259s are always remapped so their spurious IRQs do not land on CPU
+//exception vectors, even when the APIC takes over
 void pic_init(void) {
-	//disable APIC
 	uint32_t apicBase;
 	uint32_t unused;
-	x86_readMSR(0x1B, &apicBase, &unused);
-	x86_writeMSR(0x1B, apicBase & 0xFFFF0000, 0);
 	
 	//initialization control words
 	int icw1   = 0x11; //initialization word
@@ -79,15 +119,61 @@ void pic_init(void) {
 	x86_outb(PIC0_IMR_DATA, icw4); //x86
 	x86_outb(PIC1_IMR_DATA, icw4); //x86
 	
-	//enable only keyboard and PIC1 interrupts
-	x86_outb(PIC0_IMR_DATA, ~0x06);
+	//drivers unmask their own lines with pic_enableIrq
+	if(apic_init() == 0) {
+		x86_outb(PIC0_IMR_DATA, 0xFF);
+		x86_outb(PIC1_IMR_DATA, 0xFF);
+		return;
+	}
+	
+	//no APIC: disable it so the 8259 drives the CPU directly
+	x86_readMSR(0x1B, &apicBase, &unused);
+	x86_writeMSR(0x1B, apicBase & 0xFFFF0000, 0);
+	
+	//enable only PIC1 interrupts (cascade)
+	x86_outb(PIC0_IMR_DATA, ~0x04);
 	x86_outb(PIC1_IMR_DATA, ~0x00);
 }
 
 //end of interrupt
 void pic_eoi(uint8_t irqLine) {
+	if(apic_isEnabled()) { //one MMIO write instead of one or two port writes
+		apic_eoi();
+		return;
+	}
+	
 	if(irqLine >= 8) //send to slave only if IRQ came from it
 		x86_outb(PIC1_CMD_STAT, 0x20); //EOI code is 0x20
 	x86_outb(PIC0_CMD_STAT, 0x20); //send to master regardless
 }
 
+//unmask one ISA IRQ line; it is delivered at IRQ_VECTOR_BASE + irqLine
+void pic_enableIrq(uint8_t irqLine) {
+	if(apic_isEnabled())
+		apic_enableIrq(irqLine, IRQ_VECTOR_BASE + irqLine, 0, 0); //ISA: edge, active high
+	else if(irqLine >= 8)
+		x86_outb(PIC1_IMR_DATA, x86_inb(PIC1_IMR_DATA) & ~(1 << (irqLine - 8)));
+	else
+		x86_outb(PIC0_IMR_DATA, x86_inb(PIC0_IMR_DATA) & ~(1 << irqLine));
+}
+
+//PCI INTx lines are level triggered and active low. irqLine is the
+//function's interrupt line register, which the BIOS programs for the
+//8259; with an I/O APIC it is assumed to be wired to the same input
+//(there is no AML interpreter to read the _PRT routing).
+void pic_enablePciIrq(uint8_t irqLine) {
+	if(apic_isEnabled())
+		apic_enableIrq(irqLine, IRQ_VECTOR_BASE + irqLine, 1, 1);
+	else
+		pic_enableIrq(irqLine);
+}
+
+void pic_disableIrq(uint8_t irqLine) {
+	if(apic_isEnabled())
+		apic_disableIrq(irqLine);
+	else if(irqLine >= 8)
+		x86_outb(PIC1_IMR_DATA, x86_inb(PIC1_IMR_DATA) | (1 << (irqLine - 8)));
+	else
+		x86_outb(PIC0_IMR_DATA, x86_inb(PIC0_IMR_DATA) | (1 << irqLine));
+}
+
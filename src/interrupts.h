@@ -11,6 +11,13 @@
 
 #include <stdint.h> //fixed-size integer types
 
+#define IRQ_VECTOR_BASE 0x20 //ISA IRQ n is delivered at vector 0x20 + n
+
+//vectors handed out by allocInterruptVectors; those below are the ISA
+//IRQs and the fixed vector used by test_interrupts1
+#define DYNAMIC_VECTOR_BASE 0x50
+#define DYNAMIC_VECTOR_END 0xF0
+
 struct interrupt_frame;
 
 void setInterruptDescriptor(void (*isr)(struct interrupt_frame *),
@@ -18,7 +25,20 @@ void setInterruptDescriptor(void (*isr)(struct interrupt_frame *),
 
 void loadIdt(void);
 
+//reserves count consecutive unused vectors whose first vector is a
+//multiple of align (a power of 2; multiple-message MSI needs the block
+//aligned to its size). returns the first vector or -1 if none are free.
+//the caller installs handlers with setInterruptDescriptor.
+int allocInterruptVectors(uint8_t count, uint8_t align);
+void freeInterruptVectors(uint8_t vector, uint8_t count);
+
+//uses the local APIC and I/O APIC if the ACPI MADT describes them
+//(acpi_init must be called first), otherwise the 8259 PICs. all IRQ
+//lines start out masked.
 void pic_init(void);
 void pic_eoi(uint8_t irqLine);
+void pic_enableIrq(uint8_t irqLine);
+void pic_enablePciIrq(uint8_t irqLine);
+void pic_disableIrq(uint8_t irqLine);
 
 #endif
@@ -12,17 +12,50 @@
 #include "text_util.h"
 #include "string_util.h"
 #include "keyboard.h"
+#include "timer.h"
+#include "event.h"
+#include "serial.h"
+#include "apic.h"
 
 INTERRUPT_HANDLER void isr_test(struct interrupt_frame *f) {
 	const char *str = "Interrupt :)";
 	setTextColor(COLOR_YELLOW, COLOR_BLUE);
 	setCursorPosition(NUM_ROWS / 4, (NUM_COLS - strlen(str)) / 2);
 	printRaw(str);
+	flushDisplay();
 }
 
 INTERRUPT_HANDLER void isr_keyboard(struct interrupt_frame *f) {
-	keyboard_checkInput();
+	keyboard_interrupt();
+	event_post(EVENT_KEYBOARD);
 	pic_eoi(1);
 }
 
+INTERRUPT_HANDLER void isr_timer(struct interrupt_frame *f) {
+	pic_eoi(0);
+	timer_tick();
+}
+
+INTERRUPT_HANDLER void isr_serial(struct interrupt_frame *f) {
+	if(serial_interrupt() > 0)
+		event_post(EVENT_SERIAL);
+	pic_eoi(4);
+}
+
+//local APIC spurious interrupt, or 8259 spurious IRQ7: no EOI is sent
+INTERRUPT_HANDLER void isr_spurious(struct interrupt_frame *f) {
+}
+
+//8259 spurious IRQ15: the secondary gets no EOI, but the primary saw a
+//real request on its cascade input
+INTERRUPT_HANDLER void isr_spuriousSecondary(struct interrupt_frame *f) {
+	if(!apic_isEnabled())
+		pic_eoi(2);
+}
+
+//message signalled interrupts always arrive through the local APIC
+INTERRUPT_HANDLER void isr_msiTest(struct interrupt_frame *f) {
+	apic_eoi();
+}
+
 //NOTE: for PIC vectors 7 and 15, make sure to check for spurrious IRQs.
@@ -15,5 +15,10 @@
 
 INTERRUPT_HANDLER void isr_test(struct interrupt_frame *f);
 INTERRUPT_HANDLER void isr_keyboard(struct interrupt_frame *f);
+INTERRUPT_HANDLER void isr_timer(struct interrupt_frame *f);
+INTERRUPT_HANDLER void isr_serial(struct interrupt_frame *f);
+INTERRUPT_HANDLER void isr_spurious(struct interrupt_frame *f);
+INTERRUPT_HANDLER void isr_spuriousSecondary(struct interrupt_frame *f);
+INTERRUPT_HANDLER void isr_msiTest(struct interrupt_frame *f);
 
 #endif //ISR_H
@@ -1,7 +1,8 @@
 /* J. Kent Wirant
  * osmium
  * keyboard.c
- * Description: PS/2 keyboard driver plus enabling A20.
+ * Description: PS/2 keyboard driver and 8042 controller setup. (A20 is
+ *   enabled by the bootloader, before the kernel is copied above 1 MiB.)
  */
  
 //referenced https://wiki.osdev.org/PS/2_Keyboard
@@ -12,8 +13,16 @@
 #include "text_util.h"
 #include "string_util.h"
 #include "keyboard.h"
+#include "interrupts.h"
+#include "ring.h"
+#include "timer.h"
+#include "event.h"
 
 #define KEYBOARD_CMD_QUEUE_SIZE 16
+#define KEYBOARD_CMD_RETRIES 3 //resends of one byte before a command is dropped
+#define KEYBOARD_POLL_LIMIT 100000 //status reads before a controller wait gives up
+#define KEYBOARD_CMD_TIMEOUT_NS 20000000ULL //a byte with no response is sent again
+#define KEYBOARD_INPUT_RING_SIZE 64 //bytes; power of two
 
 typedef uint8_t char_t;
 
@@ -23,98 +32,193 @@ static const uint16_t CMD_STAT_PORT = 0x64;
 static const uint8_t RESPONSE_ERR0              = 0x00;
 static const uint8_t RESPONSE_SELF_TEST_PASSED  = 0xAA;
 static const uint8_t RESPONSE_ECHO              = 0xEE;
-static const uint8_t RESPONSE_ACK               = 0xF0;
+static const uint8_t RESPONSE_ACK               = 0xFA;
 static const uint8_t RESPONSE_SELF_TEST_FAILED0 = 0xFC;
 static const uint8_t RESPONSE_SELF_TEST_FAILED1 = 0xFD;
 static const uint8_t RESPONSE_RESEND            = 0xFE;
 static const uint8_t RESPONSE_ERR1              = 0xFF;
 
-static char_t state_start(uint8_t scancode);
-static char_t state_extendedCode(uint8_t scancode);
-static char_t state_pause(uint8_t scancode);
-static char_t state_pausePr(uint8_t scancode);
-static char_t state_pauseRl(uint8_t scancode);
-static char_t state_prtscPr1(uint8_t scancode);
-static char_t state_prtscPr2(uint8_t scancode);
-static char_t state_prtscRl1(uint8_t scancode);
-static char_t state_prtscRl2(uint8_t scancode);
-static char_t state_error(uint8_t scancode);
-
-typedef char_t (*KeyboardState)(uint8_t);
-KeyboardState keyboardState = state_start;
-
-static struct Command {
+//bytes received by the interrupt handler, not yet processed
+static uint8_t inputBuffer[KEYBOARD_INPUT_RING_SIZE];
+static struct Ring inputRing;
+
+//decoded key presses. like struct Ring, eventHead is only written by the
+//decoder and eventTail only by the reader.
+static struct KeyEvent eventQueue[KEYBOARD_EVENT_QUEUE_SIZE];
+static volatile uint32_t eventHead = 0;
+static volatile uint32_t eventTail = 0;
+static uint32_t eventsDropped = 0;
+
+struct Command {
 	enum CommandID cmdId;
 	uint8_t data;
 };
 
-//uses scan code set 1
-static char_t scanCodeTable[] = {
-	0x00, 0x1B, '1',  '2',
-	'3',  '4',  '5',  '6',
-	'7',  '8',  '9',  '0',
-	'-',  '=',  '\b', '\t',
-	'q',  'w',  'e',  'r',
-	't',  'y',  'u',  'i',
-	'o',  'p',  '[',  ']',
-	'\n', 0x02, 'a',  's',
-	'd',  'f',  'g',  'h',
-	'j',  'k',  'l',  ';',
-	'\'', '`',  0x03, '\\',
-	'z',  'x',  'c',  'v',
-	'b',  'n',  'm',  ',',
-	'.',  '/',  0x04, '*',
-	0x05, ' ',  0x06, 0x07,
-	0x0E, 0x0F, 0x10, 0x11,
-	0x12, 0x13, 0x14, 0x15,
-	0x16, 0x17, 0x18, '7', //keypad entries
-	'8',  '9',  '-',  '4',
-	'5',  '6',  '+',  '1',
-	'2',  '3',  '0',  '.',
-	0x00, 0x00, 0x00, 0x19,
-	0x1A, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00,
-	0x1C, 0x00, 0x00, 0x00, //extended key codes; add 0x50 to access
-	0x00, 0x00, 0x00, 0x00,
-	0x00, 0x1D, 0x00, 0x00,
-	'\n', 0x1E, 0x00, 0x00, 
-	0xFF, 0xFF, 0xFF, 0x00, //0xFF -> key exists but is unimplemented
-	0xFF, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0xFF, 0x00,
-	0xFF, 0x00, 0xFF, 0x00,
-	0x00, '/',  0x00, 0x00,
-	0x1F, 0x00, 0x00, 0x00, //0x38
-	0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x80,
-	0x81, 0x82, 0x00, 0x83,
-	0x00, 0x84, 0x00, 0x85,
-	0x86, 0x87, 0x88, 0x7F,
-	0x00, 0x00, 0x00, 0x00, //0x54
-	0x00, 0x00, 0x00, 0x89,
-	0x8A, 0x8B, 0x8C, 0x8D,
-	0x00, 0x00, 0x00, 0x8E,
-	0x00, 0x8F, 0x90, 0x91, //0x64
-	0x92, 0x93, 0x94, 0x95,
-	0x96, 0x97, 0x00, 0x00  //0x6C
+//command byte sent to the keyboard for each CommandID; all of them are
+//followed by a data byte except CMD_ENABLE_SCANNING
+static const uint8_t commandBytes[] = {
+	[CMD_SCAN_CODE_SET] = 0xF0,
+	[CMD_SET_LEDS] = 0xED,
+	[CMD_SET_TYPEMATIC] = 0xF3,
+	[CMD_ENABLE_SCANNING] = 0xF4
+};
+
+//decoder states. a sequence of prefix bytes moves through these until the
+//byte that completes a key arrives.
+enum DecodeState {
+	STATE_START,
+	STATE_E0,       //extended key
+	STATE_F0,       //set 2 release
+	STATE_E0_F0,    //set 2 extended release
+	STATE_E1,       //pause, first byte
+	STATE_E1_KEY,   //pause, second byte
+	STATE_E1_F0,    //set 2 pause release, first byte
+	STATE_E1_F0_KEY,//set 2 pause release, second byte
+	NUM_DECODE_STATES
+};
+
+//what a byte means to the decoder; see buildDecoderTables()
+enum ByteClass {
+	CLASS_MAKE,
+	CLASS_BREAK, //set 1 only: make code with bit 7 set
+	CLASS_E0,
+	CLASS_E1,
+	CLASS_F0,    //set 2 only
+	CLASS_IGNORE,
+	NUM_BYTE_CLASSES
+};
+
+//transition table entry: next state in the low nibble, action in the high
+#define ACTION_MAKE     0x10
+#define ACTION_BREAK    0x20
+#define ACTION_EXTENDED 0x40 //key code gets KEY_CODE_EXTENDED
+#define T(next, action) ((next) | (action))
+
+#define KEY_CODE_EXTENDED 0x80
+
+//pause sends its whole sequence when pressed and nothing when released.
+//it decodes as extended key 0x45 (its last byte in set 1), so it cannot
+//be mistaken for NumLk. set 1 print screen is E0 2A E0 37; the fake
+//shift E0 2A (E0 12 in set 2) maps to no key and is dropped.
+static const uint8_t transitions[NUM_DECODE_STATES][NUM_BYTE_CLASSES] = {
+	[STATE_START] = {
+		T(STATE_START, ACTION_MAKE), T(STATE_START, ACTION_BREAK),
+		T(STATE_E0, 0), T(STATE_E1, 0), T(STATE_F0, 0), T(STATE_START, 0)
+	},
+	[STATE_E0] = {
+		T(STATE_START, ACTION_MAKE | ACTION_EXTENDED),
+		T(STATE_START, ACTION_BREAK | ACTION_EXTENDED),
+		T(STATE_E0, 0), T(STATE_E1, 0), T(STATE_E0_F0, 0), T(STATE_START, 0)
+	},
+	[STATE_F0] = {
+		T(STATE_START, ACTION_BREAK), T(STATE_START, 0),
+		T(STATE_E0, 0), T(STATE_E1, 0), T(STATE_F0, 0), T(STATE_START, 0)
+	},
+	[STATE_E0_F0] = {
+		T(STATE_START, ACTION_BREAK | ACTION_EXTENDED), T(STATE_START, 0),
+		T(STATE_E0, 0), T(STATE_E1, 0), T(STATE_E0_F0, 0), T(STATE_START, 0)
+	},
+	[STATE_E1] = {
+		T(STATE_E1_KEY, 0), T(STATE_E1_F0_KEY, 0),
+		T(STATE_E0, 0), T(STATE_E1, 0), T(STATE_E1_F0, 0), T(STATE_START, 0)
+	},
+	[STATE_E1_KEY] = {
+		T(STATE_START, ACTION_MAKE | ACTION_EXTENDED),
+		T(STATE_START, ACTION_BREAK | ACTION_EXTENDED),
+		T(STATE_E0, 0), T(STATE_E1, 0), T(STATE_E1_F0_KEY, 0), T(STATE_START, 0)
+	},
+	[STATE_E1_F0] = {
+		T(STATE_E1_F0_KEY, 0), T(STATE_E1_F0_KEY, 0),
+		T(STATE_E0, 0), T(STATE_E1, 0), T(STATE_E1_F0, 0), T(STATE_START, 0)
+	},
+	[STATE_E1_F0_KEY] = {
+		T(STATE_START, ACTION_BREAK | ACTION_EXTENDED),
+		T(STATE_START, ACTION_BREAK | ACTION_EXTENDED),
+		T(STATE_E0, 0), T(STATE_E1, 0), T(STATE_E1_F0_KEY, 0), T(STATE_START, 0)
+	}
+};
+
+//scan code set 2 make code -> set 1 make code. extended keys translate
+//the same way as the key they share a code with (E0 75 -> E0 48).
+static const uint8_t set2ToSet1[0x84] = {
+	0x00, 0x43, 0x00, 0x3F, 0x3D, 0x3B, 0x3C, 0x58, //0x00
+	0x00, 0x44, 0x42, 0x40, 0x3E, 0x0F, 0x29, 0x00, //0x08
+	0x65, 0x38, 0x2A, 0x00, 0x1D, 0x10, 0x02, 0x00, //0x10
+	0x66, 0x00, 0x2C, 0x1F, 0x1E, 0x11, 0x03, 0x5B, //0x18
+	0x67, 0x2E, 0x2D, 0x20, 0x12, 0x05, 0x04, 0x5C, //0x20
+	0x68, 0x39, 0x2F, 0x21, 0x14, 0x13, 0x06, 0x5D, //0x28
+	0x69, 0x31, 0x30, 0x23, 0x22, 0x15, 0x07, 0x5E, //0x30
+	0x6A, 0x00, 0x32, 0x24, 0x16, 0x08, 0x09, 0x5F, //0x38
+	0x6B, 0x33, 0x25, 0x17, 0x18, 0x0B, 0x0A, 0x00, //0x40
+	0x6C, 0x34, 0x35, 0x26, 0x27, 0x19, 0x0C, 0x00, //0x48
+	0x6D, 0x00, 0x28, 0x00, 0x1A, 0x0D, 0x00, 0x00, //0x50
+	0x3A, 0x36, 0x1C, 0x1B, 0x00, 0x2B, 0x63, 0x00, //0x58
+	0x00, 0x56, 0x00, 0x00, 0x00, 0x00, 0x0E, 0x00, //0x60
+	0x00, 0x4F, 0x00, 0x4B, 0x47, 0x00, 0x00, 0x00, //0x68
+	0x52, 0x53, 0x50, 0x4C, 0x4D, 0x48, 0x01, 0x45, //0x70
+	0x57, 0x4E, 0x51, 0x4A, 0x37, 0x49, 0x46, 0x00, //0x78
+	0x00, 0x00, 0x00, 0x41                          //0x80
+};
+
+//key codes (set 1 make codes) that do not depend on the layout; the
+//printable keys are filled in from struct Layout
+static const char_t keyCodes[128] = {
+	0x00, 0x1B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, //0x00
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, '\b', '\t', //0x08
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, //0x10
+	0x00, 0x00, 0x00, 0x00, '\n', 0x02, 0x00, 0x00, //0x18
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, //0x20
+	0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, //0x28
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04,  '*', //0x30
+	0x05,  ' ', 0x06, 0x07, 0x0E, 0x0F, 0x10, 0x11, //0x38
+	0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18,  '7', //0x40
+	 '8',  '9',  '-',  '4',  '5',  '6',  '+',  '1', //0x48
+	 '2',  '3',  '0',  '.', 0x00, 0x00, 0x00, 0x19, //0x50
+	0x1A, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, //0x58
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, //0x60
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, //0x68
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, //0x70
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00  //0x78
+};
+
+//E0-prefixed keys; 0xFF -> key exists but is unimplemented
+static const char_t extendedKeyCodes[128] = {
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, //0x00
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, //0x08
+	0x1C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, //0x10
+	0x00, 0x1D, 0x00, 0x00, '\n', 0x1E, 0x00, 0x00, //0x18
+	0xFF, 0xFF, 0xFF, 0x00, 0xFF, 0x00, 0x00, 0x00, //0x20
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0x00, //0x28
+	0xFF, 0x00, 0xFF, 0x00, 0x00,  '/', 0x00, 0x00, //0x30
+	0x1F, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, //0x38
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, //0x40
+	0x81, 0x82, 0x00, 0x83, 0x00, 0x84, 0x00, 0x85, //0x48
+	0x86, 0x87, 0x88, 0x7F, 0x00, 0x00, 0x00, 0x00, //0x50
+	0x00, 0x00, 0x00, 0x89, 0x8A, 0x8B, 0x8C, 0x8D, //0x58
+	0x00, 0x00, 0x00, 0x8E, 0x00, 0x8F, 0x90, 0x91, //0x60
+	0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x00, 0x00, //0x68
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, //0x70
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00  //0x78
+};
+
+//the printable keys of a layout, as four rows of the main block starting
+//at these key codes; rows end at the first NUL
+static const uint8_t layoutRowStart[4] = { 0x02, 0x10, 0x1E, 0x2B };
+
+struct Layout {
+	const char *base[4];
+	const char *shift[4];
 };
 
-static char_t shiftTable[] = {
-	0x00, 0x1B, '!',  '@',
-	'#',  '$',  '%',  '^',
-	'&',  '*',  '(',  ')',
-	'_',  '+',  '\b', '\t',
-	'q',  'w',  'e',  'r',
-	't',  'y',  'u',  'i',
-	'o',  'p',  '{',  '}',
-	'\n', 0x02, 'a',  's',
-	'd',  'f',  'g',  'h',
-	'j',  'k',  'l',  ':',
-	'"',  '~',  0x03, '|',
-	'z',  'x',  'c',  'v',
-	'b',  'n',  'm',  '<',
-	'>',  '?'
+static const struct Layout layouts[] = {
+	[KEYBOARD_LAYOUT_US] = {
+		{ "1234567890-=", "qwertyuiop[]", "asdfghjkl;'`", "\\zxcvbnm,./" },
+		{ "!@#$%^&*()_+", "qwertyuiop{}", "asdfghjkl:\"~", "|zxcvbnm<>?" }
+	},
+	[KEYBOARD_LAYOUT_DVORAK] = {
+		{ "1234567890[]", "',.pyfgcrl/=", "aoeuidhtns-`", "\\;qjkxbmwvz" },
+		{ "!@#$%^&*(){}", "\"<>pyfgcrl?+", "aoeuidhtns_~", "|:qjkxbmwvz" }
+	}
 };
 
 /* keyFlags:
@@ -132,6 +236,24 @@ static char_t shiftTable[] = {
  */
 static uint16_t keyFlags = 0;
 
+#define LOCK_FLAGS 0x000E //toggled by a press instead of held
+
+//lock bits of keyFlags that the LEDs were last set to
+static uint16_t ledFlags = 0;
+
+//built from the tables above so decoding a byte takes a fixed number of
+//lookups: byte class, transition, key code, keymap layer, flag mask
+static uint8_t byteClasses[2][256];
+static uint8_t byteKeyCodes[2][256];
+static char_t keymaps[4][256];
+static uint16_t flagMasks[256];
+
+//decoder state; see keyboard_setScanCodeSet() and keyboard_setLayout()
+static uint8_t scanCodeSet = 0; //0 for set 1, 1 for set 2
+static uint8_t decodeState = STATE_START;
+static uint8_t layer = 0; //keymaps index: bit 0 shift, bit 1 CAPS
+static uint8_t awaitingResponse = 0;
+
 //callback function
 void (*keyEventHandler)(char_t c, uint8_t keyCode, uint16_t flags) = 0;
 
@@ -139,6 +261,20 @@ struct Command cmdQueue[KEYBOARD_CMD_QUEUE_SIZE];
 uint32_t queueStart = 0;
 uint32_t queueLength = 0;
 
+//progress of the command at queueStart. one byte is in flight at a time:
+//it is written when the controller can take it and the next one is only
+//sent after the keyboard acknowledges it.
+static uint8_t bytesAcked = 0;
+static uint8_t retries = 0;
+static uint64_t sentAt = 0; //timer_nowNs() when the byte in flight was written
+static uint32_t commandsFailed = 0;
+static struct Timer commandTimer;
+
+//read from the 8042 configuration byte; translated keyboards always send
+//set 1 whatever set they are told to use
+static uint8_t translationEnabled = 1;
+static int controllerStatus = 0;
+
 //function prototypes
 uint8_t keyboard_queueCommand(enum CommandID id, uint8_t data);
 void processScanCode(uint8_t scancode);
@@ -146,11 +282,17 @@ void tryCommand(void);
 uint8_t keyboard_checkInput(void);
 void keyboard_init(void (*handler)(char_t, uint8_t, uint16_t));
 
-//returns true if sucessfully added to queue. Does not validate command.
+//returns true if sucessfully added to queue. the command is sent from
+//the main loop once the commands before it are acknowledged.
 uint8_t keyboard_queueCommand(enum CommandID id, uint8_t data) {
 	//if queue is not full, assign new element
 	uint8_t hasRoom = (queueLength < KEYBOARD_CMD_QUEUE_SIZE);
 	
+	if(id >= sizeof(commandBytes))
+		return 0;
+	if(id == CMD_SCAN_CODE_SET && data != 1 && data != 2) //decodable sets only
+		return 0;
+	
 	if(hasRoom) {
 		int idx = (queueStart + queueLength) % KEYBOARD_CMD_QUEUE_SIZE;
 		struct Command *cmd = &cmdQueue[idx];
@@ -159,266 +301,504 @@ uint8_t keyboard_queueCommand(enum CommandID id, uint8_t data) {
 		queueLength++;
 	}
 	
+	tryCommand();
 	return hasRoom;
 }
 
-static char_t state_start(uint8_t scancode) {
-	switch(scancode) {
-		case 0xE0:
-			keyboardState = state_extendedCode;
-			break;
-		case 0xE1:
-			keyboardState = state_pause;
-			break;
-		default:
-			return scanCodeTable[scancode & 0x7F];
-	}
-	return 0;
-}
-
-//TODO: implement await state
-static char_t state_awaitingResponse(uint8_t scancode) {
-	keyboardState = state_start;
-}
-
-static char_t state_extendedCode(uint8_t scancode) {
-	switch(scancode) {
-		case 0x2A:
-			keyboardState = state_prtscPr1;
-			break;
-		case 0xB7:
-			keyboardState = state_prtscRl1;
-			break;
-		default:
-			keyboardState = state_start;
-			return scanCodeTable[(scancode & 0x7F) + 0x50];
+//byte classes and key codes of both scan code sets, and the key flag
+//each modifier or lock key controls. run once by keyboard_init().
+static void buildDecoderTables(void) {
+	static const char_t modifierKeys[9] = {
+		0x06, 0x17, 0x18, 0x03, 0x04, 0x02, 0x1E, 0x05, 0x1F
+	}; //keyFlags bits 1 to 9
+	
+	for(uint32_t i = 0; i < 256; i++) {
+		//set 1: bit 7 marks a release
+		byteClasses[0][i] = (i & 0x80) ? CLASS_BREAK : CLASS_MAKE;
+		byteKeyCodes[0][i] = i & 0x7F;
+		
+		//set 2: releases are prefixed with F0; bytes past the last make
+		//code are responses, which the decoder skips
+		byteClasses[1][i] = (i < sizeof(set2ToSet1)) ? CLASS_MAKE : CLASS_IGNORE;
+		byteKeyCodes[1][i] = (i < sizeof(set2ToSet1)) ? set2ToSet1[i] : 0;
+		
+		flagMasks[i] = 0;
+		for(uint32_t bit = 0; bit < 9; bit++) {
+			char_t c = (i & KEY_CODE_EXTENDED) ? extendedKeyCodes[i & 0x7F] : keyCodes[i];
+			if(c == modifierKeys[bit])
+				flagMasks[i] = 1 << (bit + 1);
+		}
 	}
-	return 0;
-}
-
-static char_t state_pause(uint8_t scancode) {
-	switch(scancode) {
-		case 0x1D:
-			keyboardState = state_pausePr;
-			break;
-		case 0x9D:
-			keyboardState = state_pauseRl;
-			break;
-		default:
-			keyboardState = state_error;
+	
+	for(uint32_t set = 0; set < 2; set++) {
+		byteClasses[set][0x00] = CLASS_IGNORE; //key detection error
+		byteClasses[set][0xE0] = CLASS_E0;
+		byteClasses[set][0xE1] = CLASS_E1;
 	}
-	return 0;
+	
+	byteClasses[1][0xF0] = CLASS_F0;
 }
 
-static char_t state_pausePr(uint8_t scancode) {
-	switch(scancode) {
-		case 0x45:
-			//pause press event
-			keyboardState = state_start;
-			break;
-		default:
-			keyboardState = state_error;
+//fills the four keymap layers: none, shift, CAPS, and shift with CAPS.
+//CAPS only affects letters, like a real keyboard.
+int keyboard_setLayout(enum KeyboardLayout layout) {
+	const struct Layout *def;
+	
+	if(layout >= sizeof(layouts) / sizeof(layouts[0]))
+		return -1;
+	
+	def = &layouts[layout];
+	
+	for(uint32_t i = 0; i < 128; i++) {
+		for(uint32_t l = 0; l < 4; l++) {
+			keymaps[l][i] = keyCodes[i];
+			keymaps[l][i | KEY_CODE_EXTENDED] = extendedKeyCodes[i];
+		}
 	}
-	return 0;
-}
-
-static char_t state_pauseRl(uint8_t scancode) {
-	switch(scancode) {
-		case 0xC5:
-			//pause release event
-			keyboardState = state_start;
-			break;
-		default:
-			keyboardState = state_error;
+	
+	for(uint32_t row = 0; row < 4; row++) {
+		for(uint32_t i = 0; def->base[row][i] != 0; i++) {
+			uint8_t key = layoutRowStart[row] + i;
+			char_t c = def->base[row][i];
+			char_t shifted = def->shift[row][i];
+			
+			if(c >= 'a' && c <= 'z') {
+				keymaps[0][key] = c;
+				keymaps[1][key] = c & ~0x20;
+				keymaps[2][key] = c & ~0x20;
+				keymaps[3][key] = c;
+			}
+			else {
+				keymaps[0][key] = c;
+				keymaps[1][key] = shifted;
+				keymaps[2][key] = c;
+				keymaps[3][key] = shifted;
+			}
+		}
 	}
+	
 	return 0;
 }
 
-static char_t state_prtscPr1(uint8_t scancode) {
-	switch(scancode) {
-		case 0xE0:
-			keyboardState = state_prtscPr2;
-			break;
-		default:
-			keyboardState = state_error;
-	}
+//selects how received bytes are decoded; this does not reprogram the
+//keyboard. with the 8042's translation on (the BIOS default) set 1
+//arrives regardless of the keyboard's own set.
+int keyboard_setScanCodeSet(uint8_t set) {
+	if(set != 1 && set != 2)
+		return -1;
+	
+	scanCodeSet = set - 1;
+	decodeState = STATE_START;
 	return 0;
 }
 
-static char_t state_prtscRl1(uint8_t scancode) {
-	switch(scancode) {
-		case 0xE0:
-			keyboardState = state_prtscRl2;
-			break;
-		default:
-			keyboardState = state_error;
+static void pushEvent(char_t c, uint8_t scancode) {
+	uint32_t head = eventHead;
+	struct KeyEvent *event;
+	
+	if(head - eventTail >= KEYBOARD_EVENT_QUEUE_SIZE) {
+		eventsDropped++;
+		return;
 	}
-	return 0;
+	
+	event = &eventQueue[head & (KEYBOARD_EVENT_QUEUE_SIZE - 1)];
+	event->c = c;
+	event->scancode = scancode;
+	event->flags = keyFlags;
+	event->count = 1;
+	event->timestamp = timer_nowMs();
+	X86_BARRIER();
+	eventHead = head + 1;
 }
 
-static char_t state_prtscPr2(uint8_t scancode) {
-	switch(scancode) {
-		case 0x37:
-			//print screen pressed event
-			keyboardState = state_start;
-			break;
-		default:
-			keyboardState = state_error;
+//runs one byte through the transition table and reports a completed key
+void processScanCode(uint8_t scancode) {
+	const uint8_t set = scanCodeSet;
+	uint8_t entry = transitions[decodeState][byteClasses[set][scancode]];
+	uint8_t key;
+	uint16_t mask;
+	char_t c;
+	
+	decodeState = entry & 0x0F;
+	if((entry & (ACTION_MAKE | ACTION_BREAK)) == 0)
+		return;
+	
+	key = byteKeyCodes[set][scancode] | ((entry & ACTION_EXTENDED) << 1);
+	c = keymaps[layer][key];
+	if(c == 0) //no such key (or a fake shift)
+		return;
+	
+	mask = flagMasks[key];
+	if(entry & ACTION_MAKE) {
+		keyFlags |= 1;
+		keyFlags ^= mask & LOCK_FLAGS;
+		keyFlags |= mask & ~LOCK_FLAGS;
 	}
-	return 0;
-}
-
-static char_t state_prtscRl2(uint8_t scancode) {
-	switch(scancode) {
-		case 0xAA:
-			//print screen released event
-			keyboardState = state_start;
-			break;
-		default:
-			keyboardState = state_error;
+	else {
+		keyFlags &= ~(1 | (mask & ~LOCK_FLAGS));
 	}
-	return 0;
-}
-
-static char_t state_error(uint8_t scancode) {
-	keyboardState = state_start;
-	return 0;
+	
+	//either shift selects layer bit 0; CAPS is already bit 1
+	layer = (((keyFlags >> 4) | (keyFlags >> 5)) & 1) | (keyFlags & 2);
+	
+	if(entry & ACTION_MAKE)
+		pushEvent(c, key);
 }
 
-static int isCapsLockActive() {
-	return (keyFlags & 2) != 0;
+//runs in the IRQ0 handler: wakes the main loop, which calls tryCommand()
+static void commandTimeout(struct Timer *timer) {
+	event_post(EVENT_KEYBOARD);
 }
 
-static int isShiftActive() {
-	return (keyFlags & 48) != 0; //R or L shift
+static uint8_t commandLength(const struct Command *cmd) {
+	return cmd->cmdId == CMD_ENABLE_SCANNING ? 1 : 2;
 }
 
-static int isReleased() {
-	return (keyFlags & 1) == 0;
+static void finishCommand(void) {
+	struct Command *cmd = &cmdQueue[queueStart];
+	
+	//the decoder follows the keyboard once it has switched sets
+	if(bytesAcked == 2 && cmd->cmdId == CMD_SCAN_CODE_SET && !translationEnabled)
+		keyboard_setScanCodeSet(cmd->data);
+	
+	queueStart = (queueStart + 1) % KEYBOARD_CMD_QUEUE_SIZE;
+	queueLength--;
+	bytesAcked = 0;
+	retries = 0;
 }
 
-static int isPressed() {
-	return (keyFlags & 1) == 1;
+//the byte in flight was not accepted; send it again or give up
+static void retryCommand(void) {
+	awaitingResponse = 0;
+	
+	if(++retries > KEYBOARD_CMD_RETRIES) {
+		commandsFailed++;
+		finishCommand();
+	}
 }
 
-static void updateFlags(char_t c, uint8_t scancode) {
-	int bit = 0;
-
-	if(c == 0x06) bit = 1; //CAPS lock
-	else if(c == 0x03) bit = 4; //left shift
-	else if(c == 0x04) bit = 5; //right shift
-	else if(c == 0x02) bit = 6; //left control
-	else if(c == 0x1E) bit = 7; //right control
-	else if(c == 0x05) bit = 8; //left alt
-	else if(c == 0x1F) bit = 9; //right alt
-	
-	//pressed/released flag
-	keyFlags &= ~1;
-	keyFlags |= ~(scancode >> 7) & 1;
+//sends the next byte of the command at the front of the queue, if the
+//keyboard is not busy with the previous one. never waits: if the
+//controller's input buffer is still full, the timer tries again later.
+void tryCommand(void) {
+	struct Command *cmd;
 	
-	//set or clear appropriate bit in keyFlags
-	if(bit >= 4) {
-		if(scancode & 0x80) keyFlags &= ~(1 << bit); //released
-		else keyFlags |= (1 << bit); //pressed
+	if(awaitingResponse) {
+		if(timer_nowNs() - sentAt < KEYBOARD_CMD_TIMEOUT_NS)
+			return;
+		retryCommand(); //no response at all
 	}
-	else if(bit >= 1 && (scancode & 0x80) == 0) { //lock-type keys (toggle-based)
-		keyFlags ^= (1 << bit);
+	
+	if(queueLength == 0)
+		return;
+	
+	if(x86_inb(CMD_STAT_PORT) & 2) { //input buffer full
+		timer_set(&commandTimer, timer_nowNs() + 1000000ULL, commandTimeout);
+		return;
 	}
+	
+	cmd = &cmdQueue[queueStart];
+	x86_outb(DATA_PORT, bytesAcked == 0 ? commandBytes[cmd->cmdId] : cmd->data);
+	awaitingResponse = 1;
+	sentAt = timer_nowNs();
+	timer_set(&commandTimer, sentAt + KEYBOARD_CMD_TIMEOUT_NS, commandTimeout);
 }
 
-static char_t applyKeyModifiers(char_t c, uint8_t scancode) {
-	//switch letter to uppercase if (CAPS LOCK) XOR (R OR L shift)
-	if(c >= 'a' && c <= 'z' && (isCapsLockActive() ^ isShiftActive())) {
-		c &= ~0x20;
+//runs one byte from the keyboard through the command/scancode state machine
+static void processByte(uint8_t data) {
+	//scan codes sent before the keyboard saw the command can still arrive
+	//while waiting, so only ACK and RESEND are taken as the response
+	if(awaitingResponse && data == RESPONSE_ACK) {
+		struct Command *cmd = &cmdQueue[queueStart];
+		
+		timer_cancel(&commandTimer);
+		awaitingResponse = 0;
+		bytesAcked++;
+		retries = 0;
+		
+		if(bytesAcked == commandLength(cmd))
+			finishCommand();
+		
+		tryCommand();
+	}
+	else if(awaitingResponse && data == RESPONSE_RESEND) {
+		timer_cancel(&commandTimer);
+		retryCommand();
+		tryCommand();
 	}
-	else if(scancode < 0x36 && isShiftActive()) { //if R OR L shift is pressed
-		c = shiftTable[scancode & 0x7F];
+	else { //received key input
+		/* no action needed yet for:
+			RESPONSE_ERR0
+			RESPONSE_ERR1
+			RESPONSE_SELF_TEST_FAILED0
+			RESPONSE_SELF_TEST_FAILED1
+			RESPONSE_SELF_TEST_PASSED
+			RESPONSE_ECHO 
+		*/
+		processScanCode(data);
 	}
-	return c;
 }
 
-void processScanCode(uint8_t scancode) {
-	char_t c = keyboardState(scancode);
+//commands dropped after KEYBOARD_CMD_RETRIES resends or timeouts
+uint32_t keyboard_getFailedCommands(void) {
+	return commandsFailed;
+}
+
+//typematic repeats of an arrow key can be merged; other keys are kept
+//one per event since each one may change what the next one means
+static int isRepeat(const struct KeyEvent *prev, const struct KeyEvent *next) {
+	if(prev->c != next->c || prev->flags != next->flags || prev->count == 0xFFFF)
+		return 0;
+	
+	return next->c == KEY_UP || next->c == KEY_DOWN ||
+	  next->c == KEY_LEFT || next->c == KEY_RIGHT;
+}
+
+static uint32_t readEvents(struct KeyEvent *events, uint32_t max) {
+	uint32_t tail = eventTail;
+	uint32_t head = eventHead;
+	uint32_t n = 0;
+	
+	X86_BARRIER(); //read head before the events it publishes
 	
-	//process key only if the state has a valid output
-	if(c != 0) {
-		updateFlags(c, scancode);
+	while(tail != head) {
+		struct KeyEvent *event = &eventQueue[tail & (KEYBOARD_EVENT_QUEUE_SIZE - 1)];
 		
-		if(keyEventHandler != 0 && isPressed()) {
-			c = applyKeyModifiers(c, scancode);
-			keyEventHandler(c, scancode, keyFlags);
-		}
+		if(n > 0 && isRepeat(&events[n - 1], event))
+			events[n - 1].count++;
+		else if(n < max)
+			events[n++] = *event;
+		else
+			break;
+		
+		tail++;
 	}
+	
+	X86_BARRIER();
+	eventTail = tail;
+	return n;
 }
 
-void tryCommand(void) {
-	if(keyboardState != state_start) //only process command when ready
+//callback adaptor: hands queued presses to keyEventHandler one at a time
+static void dispatchEvents(void) {
+	struct KeyEvent batch[16];
+	uint32_t count;
+	
+	if(keyEventHandler == 0)
 		return;
 	
-	if(queueLength > 0) {
-		int idx = (queueStart + queueLength) % KEYBOARD_CMD_QUEUE_SIZE;
-		struct Command *cmd = &cmdQueue[idx];
-				
-		switch(cmd->cmdId) {
-			//does not work as intended yet
-			case CMD_SCAN_CODE_SET:
-				//set scan code set to 1
-				keyboardState = state_awaitingResponse;	
-				x86_outb(DATA_PORT, 0xF0);
-				x86_outb(DATA_PORT, 0x01);	
-				break;
+	while((count = readEvents(batch, 16)) > 0) {
+		for(uint32_t i = 0; i < count; i++) {
+			for(uint32_t j = 0; j < batch[i].count; j++) {
+				keyEventHandler(batch[i].c, batch[i].scancode, batch[i].flags);
+			}
 		}
 	}
 }
 
+//the decoder only changes keyFlags; the LEDs follow once per batch, so
+//replayed input never sends commands to the keyboard
+static void updateLeds(void) {
+	if((keyFlags & LOCK_FLAGS) == ledFlags)
+		return;
+	
+	//LED bits: 0 ScrLk, 1 NumLk, 2 CAPS
+	if(keyboard_queueCommand(CMD_SET_LEDS, ((keyFlags >> 3) & 1) |
+	  ((keyFlags >> 1) & 2) | ((keyFlags << 1) & 4)))
+		ledFlags = keyFlags & LOCK_FLAGS;
+}
+
 //returns true if input was found and processed
 uint8_t keyboard_checkInput(void) {
 	//read status register for output buffer status
 	uint8_t isFull = x86_inb(CMD_STAT_PORT) & 1;
 	
 	if(isFull) {
-		uint8_t data = x86_inb(DATA_PORT);
-		
-		//NOTE: command response is not fully tested
-		if(keyboardState == state_awaitingResponse) {
-			keyboardState = state_start; //no longer awaiting response
-			
-			if(data == RESPONSE_ACK) { //if acknowledged, remove cmd from queue		
-				queueLength--;
-				queueStart = (queueStart + 1) % KEYBOARD_CMD_QUEUE_SIZE;
-			}
-			else if(data == RESPONSE_RESEND) { //resend last command
-				tryCommand();
-			} 
-			else {
-				//return to start state for robustness	
-				keyboardState = state_start;
-			}
-				
-			/* no action needed yet for:
-				RESPONSE_ERR0
-				RESPONSE_ERR1
-				RESPONSE_SELF_TEST_FAILED0
-				RESPONSE_SELF_TEST_FAILED1
-				RESPONSE_SELF_TEST_PASSED
-				RESPONSE_ECHO 
-			*/	
-		}
-		else { //received key input
-			processScanCode(data);
-		}
+		processByte(x86_inb(DATA_PORT));
+		updateLeds();
+		dispatchEvents();
 	}
 	
 	return isFull;
 }
 
-void keyboard_init(void (*handler)(char_t, uint8_t, uint16_t)) {
-	//TODO: reset keyboard & check status
+//top half: only moves the byte from the controller into the ring
+void keyboard_interrupt(void) {
+	if(x86_inb(CMD_STAT_PORT) & 1) {
+		ring_push(&inputRing, x86_inb(DATA_PORT));
+	}
+}
+
+//bottom half: decodes bytes from the interrupt handler into key events
+static uint32_t decodeInput(void) {
+	uint8_t batch[16];
+	uint32_t count;
+	uint32_t total = 0;
 	
-	keyEventHandler = handler;
-	keyboardState = state_start;
+	while((count = ring_popBatch(&inputRing, batch, sizeof(batch))) > 0) {
+		for(uint32_t i = 0; i < count; i++) {
+			processByte(batch[i]);
+		}
+		
+		total += count;
+	}
 	
-	//TODO: enable A20
+	updateLeds();
+	tryCommand(); //resend after a timeout, or send the next command
+	return total;
 }
 
+//decodes recorded scan codes as if they had come from the keyboard. only
+//the decoder runs: responses are not interpreted and no LED update is sent.
+void keyboard_replay(const uint8_t *bytes, uint32_t count) {
+	for(uint32_t i = 0; i < count; i++) {
+		processScanCode(bytes[i]);
+	}
+}
+
+//returns the number of bytes processed
+uint32_t keyboard_processInput(void) {
+	uint32_t total = decodeInput();
+	dispatchEvents();
+	return total;
+}
+
+//single events are never coalesced, so a poller sees every repeat
+int keyboard_poll(struct KeyEvent *event) {
+	uint32_t tail;
+	
+	decodeInput();
+	tail = eventTail;
+	
+	if(tail == eventHead)
+		return 0;
+	
+	X86_BARRIER();
+	*event = eventQueue[tail & (KEYBOARD_EVENT_QUEUE_SIZE - 1)];
+	X86_BARRIER();
+	eventTail = tail + 1;
+	return 1;
+}
+
+uint32_t keyboard_readBatch(struct KeyEvent *events, uint32_t max) {
+	decodeInput();
+	return readEvents(events, max);
+}
+
+//presses lost because nobody read the queue in time
+uint32_t keyboard_getDroppedEvents(void) {
+	return eventsDropped;
+}
+
+//polled access to the 8042 itself, used before the IRQ is enabled. each
+//wait is bounded so a machine without a controller still boots.
+static int waitForWrite(void) {
+	for(uint32_t i = 0; i < KEYBOARD_POLL_LIMIT; i++) {
+		if((x86_inb(CMD_STAT_PORT) & 2) == 0) //input buffer empty
+			return 0;
+	}
+	return -1;
+}
+
+static int waitForRead(void) {
+	for(uint32_t i = 0; i < KEYBOARD_POLL_LIMIT; i++) {
+		if(x86_inb(CMD_STAT_PORT) & 1) //output buffer full
+			return 0;
+	}
+	return -1;
+}
+
+static int controllerCommand(uint8_t command) {
+	if(waitForWrite() != 0)
+		return -1;
+	x86_outb(CMD_STAT_PORT, command);
+	return 0;
+}
+
+static int controllerRead(uint8_t command, uint8_t *data) {
+	if(controllerCommand(command) != 0 || waitForRead() != 0)
+		return -1;
+	*data = x86_inb(DATA_PORT);
+	return 0;
+}
+
+static int controllerWrite(uint8_t command, uint8_t data) {
+	if(controllerCommand(command) != 0 || waitForWrite() != 0)
+		return -1;
+	x86_outb(DATA_PORT, data);
+	return 0;
+}
 
+//referenced https://wiki.osdev.org/%228042%22_PS/2_Controller#Initialising_the_PS.2F2_Controller
+//the ports stay disabled while the controller is tested so that no key
+//press is taken as a response. port 1 is enabled again even if a test
+//fails, since some emulated controllers fail them and still work.
+static int initController(void) {
+	uint8_t config;
+	uint8_t response;
+	int status = 0;
+	
+	if(controllerCommand(0xAD) != 0) //disable port 1
+		return KEYBOARD_ERR_TIMEOUT; //no controller
+	controllerCommand(0xA7); //disable port 2; ignored without one
+	
+	//flush bytes that arrived during boot
+	for(int i = 0; i < 16 && (x86_inb(CMD_STAT_PORT) & 1); i++) {
+		x86_inb(DATA_PORT);
+	}
+	
+	//configuration byte: bit 0 port 1 IRQ, bit 1 port 2 IRQ, bit 4 port 1
+	//clock disabled, bit 6 set 2 to set 1 translation
+	if(controllerRead(0x20, &config) != 0)
+		return KEYBOARD_ERR_TIMEOUT;
+	
+	translationEnabled = (config >> 6) & 1;
+	config &= ~0x03; //no IRQs; bit 4 keeps port 1 disabled
+	controllerWrite(0x60, config);
+	
+	if(controllerRead(0xAA, &response) != 0)
+		status = KEYBOARD_ERR_TIMEOUT;
+	else if(response != 0x55)
+		status = KEYBOARD_ERR_SELF_TEST;
+	
+	controllerWrite(0x60, config); //the self test resets some controllers
+	
+	if(status == 0) {
+		if(controllerRead(0xAB, &response) != 0)
+			status = KEYBOARD_ERR_TIMEOUT;
+		else if(response != 0x00)
+			status = KEYBOARD_ERR_PORT_TEST;
+	}
+	
+	controllerCommand(0xAE); //enable port 1
+	controllerWrite(0x60, (config & ~0x10) | 0x01);
+	return status;
+}
+
+//0 if the 8042 passed its tests, otherwise a KEYBOARD_ERR_ value
+int keyboard_getControllerStatus(void) {
+	return controllerStatus;
+}
+
+void keyboard_init(void (*handler)(char_t, uint8_t, uint16_t)) {
+	keyEventHandler = handler;
+	buildDecoderTables();
+	keyboard_setLayout(KEYBOARD_LAYOUT_US);
+	keyFlags = 0;
+	layer = 0;
+	queueStart = 0;
+	queueLength = 0;
+	bytesAcked = 0;
+	awaitingResponse = 0;
+	eventHead = 0;
+	eventTail = 0;
+	ring_init(&inputRing, inputBuffer, KEYBOARD_INPUT_RING_SIZE);
+	
+	controllerStatus = initController();
+	keyboard_setScanCodeSet(translationEnabled ? 1 : 2);
+	pic_enableIrq(1);
+	
+	//the LEDs may still show lock states from before boot
+	keyboard_queueCommand(CMD_SET_LEDS, 0);
+	ledFlags = 0;
+}
@@ -2,7 +2,8 @@
  * 19 Dec. 2022
  * ECE 1895 - Project 3
  * keyboard.h
- * Description: PS/2 keyboard driver plus enabling A20.
+ * Description: PS/2 keyboard driver and 8042 controller setup. (A20 is
+ *   enabled by the bootloader, before the kernel is copied above 1 MiB.)
  */
  
 //referenced https://wiki.osdev.org/PS/2_Keyboard
@@ -12,10 +13,79 @@
 
 //abstracts the command interface for the keyboard controller
 enum CommandID {
-	CMD_SCAN_CODE_SET //others possible
+	CMD_SCAN_CODE_SET,  //data: 1 or 2
+	CMD_SET_LEDS,       //data: bit 0 ScrLk, bit 1 NumLk, bit 2 CAPS
+	CMD_SET_TYPEMATIC,  //data: see KEYBOARD_TYPEMATIC()
+	CMD_ENABLE_SCANNING //no data
+};
+
+//typematic byte: rate 0 is 30 repeats/s down to 31 at 2/s; delay 0 to 3
+//is 250 ms to 1 s before the first repeat
+#define KEYBOARD_TYPEMATIC(rate, delay) (((delay) & 3) << 5 | ((rate) & 0x1F))
+
+#define KEYBOARD_EVENT_QUEUE_SIZE 64 //events; power of two
+
+//key codes of the arrow keys, as passed to the handler
+#define KEY_UP    0x81
+#define KEY_LEFT  0x83
+#define KEY_RIGHT 0x84
+#define KEY_DOWN  0x86
+
+//one decoded key press. held arrow keys are coalesced by
+//keyboard_readBatch() into one event whose count is the number of
+//typematic repeats it stands for.
+struct KeyEvent {
+	uint8_t c;         //character or key code, after modifiers
+	uint8_t scancode;  //key code: set 1 make code, | 0x80 if E0-prefixed
+	uint16_t flags;    //keyFlags at the time of the press
+	uint16_t count;    //presses represented by this event (at least 1)
+	uint32_t timestamp; //timer_nowMs() when the key was decoded
+};
+
+enum KeyboardLayout {
+	KEYBOARD_LAYOUT_US,
+	KEYBOARD_LAYOUT_DVORAK
 };
 
 //function prototypes
+
+//commands are sent without blocking: one byte at a time once the
+//controller can take it, each resent on RESEND or after a timeout.
+//returns 0 if the queue is full or the command is invalid.
 uint8_t keyboard_queueCommand(enum CommandID id, uint8_t data);
+uint32_t keyboard_getFailedCommands(void);
+
+//8042 problems found by keyboard_init()
+#define KEYBOARD_ERR_TIMEOUT   1 //controller did not respond (or is absent)
+#define KEYBOARD_ERR_SELF_TEST 2
+#define KEYBOARD_ERR_PORT_TEST 3
+
+//tests and configures the 8042, then enables the keyboard's IRQ.
+//handler may be null; key presses are then only delivered through
+//keyboard_poll() and keyboard_readBatch()
 void keyboard_init(void (*handler)(uint8_t, uint8_t, uint16_t));
-uint8_t keyboard_checkInput(void);
+int keyboard_getControllerStatus(void);
+uint8_t keyboard_checkInput(void); //polls the controller directly
+
+//interrupt-driven input: keyboard_interrupt() is called by the IRQ1
+//handler and only queues the byte; keyboard_processInput() decodes the
+//queued bytes from the main loop and, if a handler was given, calls it
+//once per key press. returns the number of bytes processed.
+void keyboard_interrupt(void);
+uint32_t keyboard_processInput(void);
+
+//decode pending bytes, then take events from the queue. keyboard_poll()
+//returns 0 if there is none; keyboard_readBatch() returns the number
+//of events stored in events, after coalescing.
+int keyboard_poll(struct KeyEvent *event);
+uint32_t keyboard_readBatch(struct KeyEvent *events, uint32_t max);
+uint32_t keyboard_getDroppedEvents(void);
+
+//decoding is table driven: each byte costs the same few lookups whatever
+//the scan code set, layout or modifiers. both return -1 if the argument
+//is not supported. keyboard_init() selects set 1 and the US layout.
+int keyboard_setScanCodeSet(uint8_t set);
+int keyboard_setLayout(enum KeyboardLayout layout);
+
+//feeds recorded bytes to the decoder, for tests
+void keyboard_replay(const uint8_t *bytes, uint32_t count);
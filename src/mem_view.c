@@ -0,0 +1,122 @@
+/* J. Kent Wirant
+ * osmium
+ * mem_view.c
+ * Description: Cached window over system memory for the memory editor.
+ *   Memory is only read when the window moves or is refreshed, and edits
+ *   write exactly one byte, so a window over MMIO sees no spurious accesses.
+ */
+
+#include "mem_view.h"
+#include "paging.h"
+
+static uint32_t viewBase = 0;
+static uint8_t viewData[MEM_VIEW_SIZE];
+static uint32_t changedRows = 0;
+
+static void loadRows(int firstRow, int count) {
+	volatile uint32_t *src = (volatile uint32_t *)(viewBase + firstRow * MEM_VIEW_ROW_BYTES);
+	uint32_t *dest = (uint32_t *)&viewData[firstRow * MEM_VIEW_ROW_BYTES];
+	uint32_t data;
+	
+	for(int i = 0; i < count * MEM_VIEW_ROW_BYTES / 4; i++) {
+		//unmapped memory reads like an empty bus instead of faulting
+		if(paging_isMapped((uint32_t) &src[i]))
+			data = src[i];
+		else
+			data = 0xFFFFFFFF;
+		
+		if(data != dest[i]) {
+			dest[i] = data;
+			changedRows |= 1UL << (firstRow + i / (MEM_VIEW_ROW_BYTES / 4));
+		}
+	}
+}
+
+void memView_setBase(uint32_t base) {
+	viewBase = base & ~(MEM_VIEW_ROW_BYTES - 1);
+	loadRows(0, MEM_VIEW_ROWS);
+	changedRows = (1UL << MEM_VIEW_ROWS) - 1; //addresses changed on every row
+}
+
+void memView_scroll(int rows) {
+	int shift = (rows < 0) ? -rows : rows;
+	int moved = (MEM_VIEW_ROWS - shift) * MEM_VIEW_ROW_BYTES;
+	int offset = rows * MEM_VIEW_ROW_BYTES;
+	uint32_t newRows;
+	
+	viewBase += offset;
+	
+	if(shift >= MEM_VIEW_ROWS) {
+		loadRows(0, MEM_VIEW_ROWS);
+		changedRows = (1UL << MEM_VIEW_ROWS) - 1;
+		return;
+	}
+	
+	if(rows > 0) {
+		for(int i = 0; i < moved; i++) {
+			viewData[i] = viewData[i + offset];
+		}
+		
+		changedRows >>= shift;
+		newRows = ((1UL << shift) - 1) << (MEM_VIEW_ROWS - shift);
+		loadRows(MEM_VIEW_ROWS - shift, shift);
+	}
+	else {
+		for(int i = MEM_VIEW_SIZE - 1; i >= -offset; i--) {
+			viewData[i] = viewData[i + offset];
+		}
+		
+		changedRows = (changedRows << shift) & ((1UL << MEM_VIEW_ROWS) - 1);
+		newRows = (1UL << shift) - 1;
+		loadRows(0, shift);
+	}
+	
+	//exposed rows show new addresses even if their bytes happen to match
+	changedRows |= newRows;
+}
+
+uint32_t memView_getBase(void) {
+	return viewBase;
+}
+
+void memView_refresh(void) {
+	loadRows(0, MEM_VIEW_ROWS);
+}
+
+uint8_t memView_getByte(int index) {
+	return viewData[index];
+}
+
+const uint8_t *memView_getRow(int row) {
+	return &viewData[row * MEM_VIEW_ROW_BYTES];
+}
+
+void memView_writeByte(int index, uint8_t value) {
+	volatile uint8_t *mem = (volatile uint8_t *)(viewBase + index);
+	
+	if(!paging_isMapped((uint32_t) mem))
+		return;
+	
+	*mem = value;
+	viewData[index] = *mem;
+	changedRows |= 1UL << (index / MEM_VIEW_ROW_BYTES);
+}
+
+void memView_writeNibble(int index, int highNibble, uint8_t value) {
+	uint8_t data = viewData[index];
+	
+	if(highNibble) {
+		data = (data & 0x0F) | (value << 4);
+	}
+	else {
+		data = (data & 0xF0) | (value & 0x0F);
+	}
+	
+	memView_writeByte(index, data);
+}
+
+uint32_t memView_takeChangedRows(void) {
+	uint32_t rows = changedRows;
+	changedRows = 0;
+	return rows;
+}
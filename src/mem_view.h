@@ -0,0 +1,43 @@
+/* J. Kent Wirant
+ * osmium
+ * mem_view.h
+ * Description: Cached window over system memory for the memory editor.
+ *   Memory is only read when the window moves or is refreshed, and edits
+ *   write exactly one byte, so a window over MMIO sees no spurious accesses.
+ */
+
+#ifndef MEM_VIEW_H
+#define MEM_VIEW_H
+
+#include <stdint.h>
+
+#define MEM_VIEW_ROWS 16 //16 rows of 16 bytes
+#define MEM_VIEW_ROW_BYTES 16
+#define MEM_VIEW_SIZE (MEM_VIEW_ROWS * MEM_VIEW_ROW_BYTES)
+
+//moves the window (aligned down to a row) and reads it from memory
+void memView_setBase(uint32_t base);
+uint32_t memView_getBase(void);
+
+//moves the window by a number of rows (negative moves toward lower
+//addresses), keeping cached bytes and reading only the newly exposed rows
+void memView_scroll(int rows);
+
+//reads the whole window from memory again; rows whose contents differ from
+//the cached copy are reported by memView_takeChangedRows()
+void memView_refresh(void);
+
+uint8_t memView_getByte(int index);
+const uint8_t *memView_getRow(int row);
+
+//writes one byte through to memory, then reads it back so the cache shows
+//what memory actually holds (e.g. ROM or read-only device registers)
+void memView_writeByte(int index, uint8_t value);
+
+//replaces the high (highNibble != 0) or low nibble of one byte
+void memView_writeNibble(int index, int highNibble, uint8_t value);
+
+//returns a mask of rows changed since the last call (bit n = row n)
+uint32_t memView_takeChangedRows(void);
+
+#endif //MEM_VIEW_H
@@ -0,0 +1,119 @@
+/* J. Kent Wirant
+ * osmium
+ * memory_map.c
+ * Description: Physical memory map built from the BIOS (E820) entries that
+ *   the bootloader collects. Regions are sorted by address, never overlap,
+ *   and adjacent regions of the same type are merged.
+ */
+
+#include "memory_map.h"
+
+static struct MemoryRegion regions[MEMORY_MAP_MAX_REGIONS];
+static uint32_t regionCount = 0;
+
+//higher value wins where entries overlap
+static int typePriority(uint32_t type) {
+	switch(type) {
+		case 0:                       return 0; //not covered by any entry
+		case MEMORY_USABLE:           return 1;
+		case MEMORY_ACPI_RECLAIMABLE: return 2;
+		case MEMORY_ACPI_NVS:         return 4;
+		case MEMORY_BAD:              return 5;
+		default:                      return 3; //reserved or unknown
+	}
+}
+
+static void addRegion(uint64_t base, uint64_t end, uint32_t type) {
+	struct MemoryRegion *prev = &regions[regionCount > 0 ? regionCount - 1 : 0];
+	
+	if(regionCount > 0 && prev->end == base && prev->type == type) {
+		prev->end = end; //merge with previous region
+	}
+	else if(regionCount < MEMORY_MAP_MAX_REGIONS) {
+		regions[regionCount].base = base;
+		regions[regionCount].end = end;
+		regions[regionCount].type = type;
+		regionCount++;
+	}
+}
+
+void memoryMap_init(const struct BootInfo *bootInfo) {
+	const struct E820Entry *entries = (const struct E820Entry *) bootInfo->memoryMap;
+	uint32_t count = bootInfo->memoryMapCount;
+	uint64_t points[2 * MEMORY_MAP_MAX_REGIONS];
+	uint32_t numPoints = 0;
+	uint64_t point;
+	uint32_t type;
+	int j;
+	
+	regionCount = 0;
+	
+	if(count == 0) {
+		addRegion(0, 0xA0000, MEMORY_USABLE);
+		return;
+	}
+	
+	if(count > MEMORY_MAP_MAX_REGIONS)
+		count = MEMORY_MAP_MAX_REGIONS;
+	
+	//every start and end address is a point where the type may change;
+	//insertion sort them (there are at most a few dozen)
+	for(uint32_t i = 0; i < 2 * count; i++) {
+		point = entries[i / 2].base;
+		if(i & 1) point += entries[i / 2].length;
+		
+		for(j = numPoints; j > 0 && points[j - 1] > point; j--) {
+			points[j] = points[j - 1];
+		}
+		
+		points[j] = point;
+		numPoints++;
+	}
+	
+	//the type between two neighboring points is the highest priority type
+	//of the entries covering it
+	for(uint32_t i = 0; i + 1 < numPoints; i++) {
+		if(points[i] == points[i + 1])
+			continue;
+		
+		type = 0;
+		
+		for(uint32_t k = 0; k < count; k++) {
+			if(entries[k].base <= points[i] && 
+			  entries[k].base + entries[k].length >= points[i + 1] &&
+			  typePriority(entries[k].type) > typePriority(type)) {
+				type = entries[k].type;
+			}
+		}
+		
+		if(type != 0) //gaps are not part of the map
+			addRegion(points[i], points[i + 1], type);
+	}
+}
+
+const struct MemoryRegion *memoryMap_getRegions(uint32_t *count) {
+	*count = regionCount;
+	return regions;
+}
+
+uint64_t memoryMap_getUsableBytes(void) {
+	uint64_t total = 0;
+	
+	for(uint32_t i = 0; i < regionCount; i++) {
+		if(regions[i].type == MEMORY_USABLE)
+			total += regions[i].end - regions[i].base;
+	}
+	
+	return total;
+}
+
+uint64_t memoryMap_getUsableEnd(void) {
+	uint64_t end = 0;
+	
+	for(uint32_t i = 0; i < regionCount; i++) {
+		if(regions[i].type == MEMORY_USABLE)
+			end = regions[i].end;
+	}
+	
+	return end;
+}
@@ -0,0 +1,51 @@
+/* J. Kent Wirant
+ * osmium
+ * memory_map.h
+ * Description: Physical memory map built from the BIOS (E820) entries that
+ *   the bootloader collects. Regions are sorted by address, never overlap,
+ *   and adjacent regions of the same type are merged.
+ */
+
+#ifndef MEMORY_MAP_H
+#define MEMORY_MAP_H
+
+#include <stdint.h>
+#include "boot_info.h"
+
+#define MEMORY_MAP_MAX_REGIONS 64
+
+//region types, as reported by E820
+#define MEMORY_USABLE           1
+#define MEMORY_RESERVED         2
+#define MEMORY_ACPI_RECLAIMABLE 3
+#define MEMORY_ACPI_NVS         4
+#define MEMORY_BAD              5
+
+//raw entry as returned by INT 15h, EAX=E820h
+struct E820Entry {
+	uint64_t base;
+	uint64_t length;
+	uint32_t type;
+	uint32_t attributes;
+} __attribute__((packed));
+
+struct MemoryRegion {
+	uint64_t base;
+	uint64_t end; //first address after the region
+	uint32_t type;
+};
+
+//builds the map from the bootloader's E820 entries. Where entries overlap,
+//the more restrictive type wins (e.g. reserved over usable). Without any
+//entries, only conventional memory (below 640 KiB) is assumed usable.
+void memoryMap_init(const struct BootInfo *bootInfo);
+
+const struct MemoryRegion *memoryMap_getRegions(uint32_t *count);
+
+//total size of usable regions
+uint64_t memoryMap_getUsableBytes(void);
+
+//end of the highest usable region
+uint64_t memoryMap_getUsableEnd(void);
+
+#endif //MEMORY_MAP_H
@@ -0,0 +1,253 @@
+/* J. Kent Wirant
+ * osmium
+ * page_frame.c
+ * Description: Physical memory manager. Allocates 4 KiB page frames and
+ *   contiguous runs of 2^order frames using a buddy allocator, with a
+ *   bitmap recording which frames are in use.
+ */
+
+//referenced https://wiki.osdev.org/Page_Frame_Allocation
+
+#include "page_frame.h"
+#include "memory_map.h"
+#include "paging.h"
+
+#define LOW_MEMORY_END 0x100000 //reserved for BIOS, boot code and devices
+
+//free runs are linked through their first frame; the links are doubly
+//linked so a buddy can be removed from the middle of a list in O(1)
+struct FreeRun {
+	struct FreeRun *next;
+	struct FreeRun *prev;
+};
+
+extern char _kernel_end[]; //end of kernel image and .bss (linker.ld)
+
+static struct FreeRun *freeLists[PAGE_FRAME_MAX_ORDER + 1];
+static uint32_t freeBlocks[PAGE_FRAME_MAX_ORDER + 1];
+
+//bit n is set if frame n is allocated (or not usable memory)
+static uint32_t *usedBitmap;
+
+//bit n of freeHeads[k] is set if a free run of order k starts at
+//frame n * 2^k; this lets a freed run check its buddy in O(1)
+static uint32_t *freeHeads[PAGE_FRAME_MAX_ORDER + 1];
+
+static uint32_t frameCount = 0; //frames covered by the bitmaps
+static uint32_t totalFrames = 0;
+static uint32_t freeFrames = 0;
+
+static int testBit(const uint32_t *bitmap, uint32_t n) {
+	return (bitmap[n >> 5] >> (n & 31)) & 1;
+}
+
+static void setBit(uint32_t *bitmap, uint32_t n) {
+	bitmap[n >> 5] |= 1UL << (n & 31);
+}
+
+static void clearBit(uint32_t *bitmap, uint32_t n) {
+	bitmap[n >> 5] &= ~(1UL << (n & 31));
+}
+
+static void pushRun(uint32_t frame, uint32_t order) {
+	struct FreeRun *run = (struct FreeRun *)(frame * PAGE_FRAME_SIZE);
+	
+	run->prev = 0;
+	run->next = freeLists[order];
+	if(run->next) run->next->prev = run;
+	freeLists[order] = run;
+	
+	setBit(freeHeads[order], frame >> order);
+	freeBlocks[order]++;
+}
+
+static void removeRun(uint32_t frame, uint32_t order) {
+	struct FreeRun *run = (struct FreeRun *)(frame * PAGE_FRAME_SIZE);
+	
+	if(run->prev) run->prev->next = run->next;
+	else freeLists[order] = run->next;
+	if(run->next) run->next->prev = run->prev;
+	
+	clearBit(freeHeads[order], frame >> order);
+	freeBlocks[order]--;
+}
+
+//adds a run of free frames, merging it with its buddy as long as possible
+static void freeRun(uint32_t frame, uint32_t order) {
+	uint32_t buddy;
+	
+	while(order < PAGE_FRAME_MAX_ORDER) {
+		buddy = frame ^ (1UL << order);
+		
+		if(buddy + (1UL << order) > frameCount || 
+		  !testBit(freeHeads[order], buddy >> order))
+			break;
+		
+		removeRun(buddy, order);
+		frame &= ~(1UL << order); //merged run starts at the lower buddy
+		order++;
+	}
+	
+	pushRun(frame, order);
+}
+
+static void markFrames(uint32_t frame, uint32_t count, int used) {
+	for(uint32_t i = frame; i < frame + count; i++) {
+		if(used) setBit(usedBitmap, i);
+		else clearBit(usedBitmap, i);
+	}
+}
+
+void pageFrame_init(void) {
+	const struct MemoryRegion *regions;
+	uint32_t count;
+	uint64_t end = memoryMap_getUsableEnd();
+	uint32_t bitmapWords;
+	uint32_t metadataSize;
+	uint32_t metadataStart;
+	uint32_t metadataEnd;
+	uint32_t reservedFrames;
+	uint32_t *words;
+	uint32_t first, last, order;
+	
+	//free runs are linked through the frames themselves, so only memory
+	//that stays identity mapped once paging is on can be managed
+	if(end > PAGING_IDENTITY_END) end = PAGING_IDENTITY_END;
+	frameCount = end / PAGE_FRAME_SIZE;
+	
+	//the bitmaps are placed directly after the kernel
+	bitmapWords = (frameCount + 31) / 32;
+	metadataSize = bitmapWords * 4;
+	for(order = 0; order <= PAGE_FRAME_MAX_ORDER; order++) {
+		metadataSize += (((frameCount >> order) + 31) / 32) * 4;
+	}
+	
+	metadataStart = ((uint32_t) _kernel_end + PAGE_FRAME_SIZE - 1) & ~(PAGE_FRAME_SIZE - 1);
+	metadataEnd = metadataStart + metadataSize;
+	
+	//the kernel is loaded at 1 MiB, so this covers low memory too
+	reservedFrames = (metadataEnd + PAGE_FRAME_SIZE - 1) / PAGE_FRAME_SIZE;
+	if(reservedFrames < LOW_MEMORY_END / PAGE_FRAME_SIZE)
+		reservedFrames = LOW_MEMORY_END / PAGE_FRAME_SIZE;
+	
+	words = (uint32_t *) metadataStart;
+	usedBitmap = words;
+	words += bitmapWords;
+	for(order = 0; order <= PAGE_FRAME_MAX_ORDER; order++) {
+		freeHeads[order] = words;
+		words += ((frameCount >> order) + 31) / 32;
+		freeLists[order] = 0;
+		freeBlocks[order] = 0;
+	}
+	
+	//everything starts out used and no run is free
+	for(uint32_t *w = (uint32_t *) metadataStart; w < (uint32_t *) metadataEnd; w++) {
+		*w = 0;
+	}
+	for(uint32_t i = 0; i < bitmapWords; i++) {
+		usedBitmap[i] = 0xFFFFFFFF;
+	}
+	
+	totalFrames = 0;
+	freeFrames = 0;
+	regions = memoryMap_getRegions(&count);
+	
+	for(uint32_t i = 0; i < count; i++) {
+		if(regions[i].type != MEMORY_USABLE || regions[i].base >= end)
+			continue;
+		
+		//whole frames only, skipping low memory, the kernel and the bitmaps
+		first = (regions[i].base + PAGE_FRAME_SIZE - 1) / PAGE_FRAME_SIZE;
+		last = ((regions[i].end < end) ? regions[i].end : end) / PAGE_FRAME_SIZE;
+		if(first < reservedFrames)
+			first = reservedFrames;
+		if(first >= last)
+			continue;
+		
+		markFrames(first, last - first, 0);
+		totalFrames += last - first;
+		freeFrames += last - first;
+		
+		//largest aligned runs that fit
+		while(first < last) {
+			order = PAGE_FRAME_MAX_ORDER;
+			while(order > 0 && ((first & ((1UL << order) - 1)) != 0 || 
+			  first + (1UL << order) > last)) {
+				order--;
+			}
+			
+			freeRun(first, order);
+			first += 1UL << order;
+		}
+	}
+}
+
+uint32_t pageFrame_allocRun(uint32_t order) {
+	uint32_t current = order;
+	uint32_t frame;
+	
+	if(order > PAGE_FRAME_MAX_ORDER)
+		return 0;
+	
+	//smallest run that is large enough
+	while(current <= PAGE_FRAME_MAX_ORDER && freeLists[current] == 0) {
+		current++;
+	}
+	
+	if(current > PAGE_FRAME_MAX_ORDER)
+		return 0;
+	
+	frame = (uint32_t) freeLists[current] / PAGE_FRAME_SIZE;
+	removeRun(frame, current);
+	
+	//split off the upper halves until the run has the requested size
+	while(current > order) {
+		current--;
+		pushRun(frame + (1UL << current), current);
+	}
+	
+	markFrames(frame, 1UL << order, 1);
+	freeFrames -= 1UL << order;
+	return frame * PAGE_FRAME_SIZE;
+}
+
+void pageFrame_freeRun(uint32_t address, uint32_t order) {
+	uint32_t frame = address / PAGE_FRAME_SIZE;
+	
+	//ignore frames that are not allocated (e.g. double free)
+	if(order > PAGE_FRAME_MAX_ORDER || frame >= frameCount || 
+	  !testBit(usedBitmap, frame))
+		return;
+	
+	markFrames(frame, 1UL << order, 0);
+	freeFrames += 1UL << order;
+	freeRun(frame, order);
+}
+
+uint32_t pageFrame_alloc(void) {
+	return pageFrame_allocRun(0);
+}
+
+void pageFrame_free(uint32_t address) {
+	pageFrame_freeRun(address, 0);
+}
+
+void pageFrame_getStats(struct PageFrameStats *stats) {
+	uint32_t largest = 0;
+	
+	stats->totalFrames = totalFrames;
+	stats->freeFrames = freeFrames;
+	
+	for(uint32_t order = 0; order <= PAGE_FRAME_MAX_ORDER; order++) {
+		stats->freeBlocks[order] = freeBlocks[order];
+		if(freeBlocks[order] > 0) largest = order;
+	}
+	
+	stats->largestFreeOrder = largest;
+	stats->fragmentation = 0;
+	
+	if(freeFrames > 0) {
+		stats->fragmentation = 100 - (100 * (freeBlocks[PAGE_FRAME_MAX_ORDER] << 
+		  PAGE_FRAME_MAX_ORDER)) / freeFrames;
+	}
+}
@@ -0,0 +1,39 @@
+/* J. Kent Wirant
+ * osmium
+ * page_frame.h
+ * Description: Physical memory manager. Allocates 4 KiB page frames and
+ *   contiguous runs of 2^order frames using a buddy allocator, with a
+ *   bitmap recording which frames are in use.
+ */
+
+#ifndef PAGE_FRAME_H
+#define PAGE_FRAME_H
+
+#include <stdint.h>
+
+#define PAGE_FRAME_SIZE 4096
+#define PAGE_FRAME_MAX_ORDER 10 //largest run: 2^10 frames (4 MiB)
+
+struct PageFrameStats {
+	uint32_t totalFrames; //frames of usable memory managed
+	uint32_t freeFrames;
+	uint32_t freeBlocks[PAGE_FRAME_MAX_ORDER + 1]; //free runs of each order
+	uint32_t largestFreeOrder; //order of the largest free run
+	uint32_t fragmentation; //percent of free memory in runs below max order
+};
+
+//builds the allocator from the memory map (memoryMap_init must be called
+//first). Memory below 1 MiB and the kernel image are never handed out.
+void pageFrame_init(void);
+
+//returns the physical address of a free frame, or 0 if none is left. O(1).
+uint32_t pageFrame_alloc(void);
+void pageFrame_free(uint32_t address);
+
+//allocates 2^order contiguous frames, aligned to their size; 0 on failure
+uint32_t pageFrame_allocRun(uint32_t order);
+void pageFrame_freeRun(uint32_t address, uint32_t order);
+
+void pageFrame_getStats(struct PageFrameStats *stats);
+
+#endif //PAGE_FRAME_H
@@ -0,0 +1,204 @@
+/* J. Kent Wirant
+ * osmium
+ * paging.c
+ * Description: Paging setup. Physical memory below 3 GiB is identity
+ *   mapped with 4 MiB pages, the first 256 MiB are also mapped at
+ *   PAGING_KERNEL_BASE, and device memory is mapped on request into a
+ *   window with a caller-chosen cache type.
+ */
+
+//referenced https://wiki.osdev.org/Paging
+//referenced https://wiki.osdev.org/Page_Attribute_Table
+
+#include "paging.h"
+#include "page_frame.h"
+#include "memory_map.h"
+#include "x86_util.h"
+
+#define PAGE_PRESENT 0x001
+#define PAGE_WRITABLE 0x002
+#define PAGE_PWT 0x008 //PAT index bit 0
+#define PAGE_PCD 0x010 //PAT index bit 1
+#define PAGE_LARGE 0x080 //PDE maps a 4 MiB page (requires CR4.PSE)
+
+#define CR0_PG 0x80000000
+#define CR4_PSE 0x00000010
+
+#define CPUID_EDX_PSE (1UL << 3)
+#define CPUID_EDX_PAT (1UL << 16)
+
+#define MSR_PAT 0x277
+//PAT entries 0-3: WB, WC, UC-, UC (entry 1 is WT at reset); 4-7 unchanged
+#define PAT_LO 0x00070106
+#define PAT_HI 0x00070406
+
+#define VGA_START 0xA0000
+#define VGA_END 0xC0000
+
+static uint32_t pageDirectory[1024] __attribute__((aligned(PAGING_PAGE_SIZE)));
+static uint32_t lowTable[1024] __attribute__((aligned(PAGING_PAGE_SIZE))); //first 4 MiB
+
+static int enabled = 0;
+static int hasPat = 0;
+static uint32_t nextDevice = PAGING_DEVICE_BASE;
+
+//PTE/PDE flags selecting a PAT entry; without PAT, write-combining
+//degrades to uncached
+static uint32_t cacheFlags(uint32_t cacheType) {
+	if(cacheType == PAGING_CACHE_WRITE_COMBINING && !hasPat)
+		cacheType = PAGING_CACHE_UNCACHED;
+	
+	return ((cacheType & 1) ? PAGE_PWT : 0) | ((cacheType & 2) ? PAGE_PCD : 0);
+}
+
+//RAM (including ACPI tables) is cached; anything else is device memory
+static int containsRam(uint64_t start, uint64_t end) {
+	const struct MemoryRegion *regions;
+	uint32_t count;
+	
+	regions = memoryMap_getRegions(&count);
+	
+	for(uint32_t i = 0; i < count; i++) {
+		if(regions[i].base < end && regions[i].end > start && 
+		  (regions[i].type == MEMORY_USABLE || 
+		  regions[i].type == MEMORY_ACPI_RECLAIMABLE || 
+		  regions[i].type == MEMORY_ACPI_NVS))
+			return 1;
+	}
+	
+	return 0;
+}
+
+int paging_init(void) {
+	uint32_t regs[4];
+	uint32_t address;
+	uint32_t cacheType;
+	
+	x86_cpuid(1, regs);
+	if(!(regs[3] & CPUID_EDX_PSE))
+		return -1;
+	
+	hasPat = (regs[3] & CPUID_EDX_PAT) != 0;
+	
+	//first 4 MiB in 4 KiB pages so video memory can be write-combining;
+	//the BIOS area above it keeps the firmware's MTRR setting (write-back
+	//in the PAT defers to the MTRRs)
+	for(int i = 0; i < 1024; i++) {
+		address = i * PAGING_PAGE_SIZE;
+		cacheType = (address >= VGA_START && address < VGA_END) ? 
+		  PAGING_CACHE_WRITE_COMBINING : PAGING_CACHE_WRITE_BACK;
+		lowTable[i] = address | cacheFlags(cacheType) | PAGE_WRITABLE | PAGE_PRESENT;
+	}
+	
+	pageDirectory[0] = (uint32_t) lowTable | PAGE_WRITABLE | PAGE_PRESENT;
+	
+	for(uint32_t i = 1; i < 1024; i++) {
+		address = i * PAGING_LARGE_PAGE_SIZE;
+		
+		if(address < PAGING_IDENTITY_END) {
+			cacheType = containsRam(address, (uint64_t) address + PAGING_LARGE_PAGE_SIZE) ? 
+			  PAGING_CACHE_WRITE_BACK : PAGING_CACHE_UNCACHED;
+			pageDirectory[i] = address | cacheFlags(cacheType) | 
+			  PAGE_LARGE | PAGE_WRITABLE | PAGE_PRESENT;
+		}
+		else {
+			pageDirectory[i] = 0;
+		}
+	}
+	
+	//higher-half alias shares the identity entries
+	for(uint32_t i = 0; i < PAGING_KERNEL_ALIAS_SIZE / PAGING_LARGE_PAGE_SIZE; i++) {
+		pageDirectory[PAGING_KERNEL_BASE / PAGING_LARGE_PAGE_SIZE + i] = pageDirectory[i];
+	}
+	
+	if(hasPat) {
+		x86_writeMSR(MSR_PAT, PAT_LO, PAT_HI);
+		x86_wbinvd();
+	}
+	
+	x86_writeCR3((uint32_t) pageDirectory);
+	x86_writeCR4(x86_readCR4() | CR4_PSE);
+	x86_writeCR0(x86_readCR0() | CR0_PG);
+	enabled = 1;
+	return 0;
+}
+
+int paging_isEnabled(void) {
+	return enabled;
+}
+
+int paging_isMapped(uint32_t address) {
+	uint32_t pde;
+	
+	if(!enabled)
+		return 1;
+	
+	pde = pageDirectory[address >> 22];
+	
+	if(!(pde & PAGE_PRESENT))
+		return 0;
+	if(pde & PAGE_LARGE)
+		return 1;
+	
+	return ((uint32_t *)(pde & ~(PAGING_PAGE_SIZE - 1)))[(address >> 12) & 0x3FF] & PAGE_PRESENT;
+}
+
+void *paging_mapDevice(uint32_t phys, uint32_t size, uint32_t cacheType) {
+	uint32_t offset;
+	uint32_t virt;
+	uint32_t flags;
+	uint32_t *table;
+	
+	if(!enabled)
+		return (void *) phys;
+	
+	if(size == 0)
+		return 0;
+	
+	flags = cacheFlags(cacheType) | PAGE_WRITABLE | PAGE_PRESENT;
+	
+	if(size >= PAGING_LARGE_PAGE_SIZE) {
+		offset = phys & (PAGING_LARGE_PAGE_SIZE - 1);
+		size = (size + offset + PAGING_LARGE_PAGE_SIZE - 1) & ~(PAGING_LARGE_PAGE_SIZE - 1);
+		virt = (nextDevice + PAGING_LARGE_PAGE_SIZE - 1) & ~(PAGING_LARGE_PAGE_SIZE - 1);
+		
+		if(size > PAGING_DEVICE_END - virt)
+			return 0;
+		
+		for(uint32_t i = 0; i < size; i += PAGING_LARGE_PAGE_SIZE) {
+			pageDirectory[(virt + i) >> 22] = (phys - offset + i) | flags | PAGE_LARGE;
+			x86_invlpg(virt + i);
+		}
+	}
+	else {
+		offset = phys & (PAGING_PAGE_SIZE - 1);
+		size = (size + offset + PAGING_PAGE_SIZE - 1) & ~(PAGING_PAGE_SIZE - 1);
+		virt = nextDevice;
+		
+		if(size > PAGING_DEVICE_END - virt)
+			return 0;
+		
+		for(uint32_t i = 0; i < size; i += PAGING_PAGE_SIZE) {
+			uint32_t *pde = &pageDirectory[(virt + i) >> 22];
+			
+			//page tables come from identity-mapped frames
+			if(!(*pde & PAGE_PRESENT)) {
+				table = (uint32_t *) pageFrame_alloc();
+				if(table == 0) return 0;
+				
+				for(int j = 0; j < 1024; j++) {
+					table[j] = 0;
+				}
+				
+				*pde = (uint32_t) table | PAGE_WRITABLE | PAGE_PRESENT;
+			}
+			
+			table = (uint32_t *)(*pde & ~(PAGING_PAGE_SIZE - 1));
+			table[((virt + i) >> 12) & 0x3FF] = (phys - offset + i) | flags;
+			x86_invlpg(virt + i);
+		}
+	}
+	
+	nextDevice = virt + size;
+	return (void *)(virt + offset);
+}
@@ -0,0 +1,44 @@
+/* J. Kent Wirant
+ * osmium
+ * paging.h
+ * Description: Paging setup. Physical memory below 3 GiB is identity
+ *   mapped with 4 MiB pages, the first 256 MiB are also mapped at
+ *   PAGING_KERNEL_BASE, and device memory is mapped on request into a
+ *   window with a caller-chosen cache type.
+ */
+
+#ifndef PAGING_H
+#define PAGING_H
+
+#include <stdint.h>
+
+#define PAGING_PAGE_SIZE 0x1000
+#define PAGING_LARGE_PAGE_SIZE 0x400000
+
+#define PAGING_IDENTITY_END 0xC0000000 //end of identity-mapped memory
+#define PAGING_KERNEL_BASE 0xC0000000 //alias of physical address 0
+#define PAGING_KERNEL_ALIAS_SIZE 0x10000000
+#define PAGING_DEVICE_BASE 0xD0000000 //window used by paging_mapDevice()
+#define PAGING_DEVICE_END 0xF0000000
+
+//cache types; these are PAT indices, set up by paging_init()
+#define PAGING_CACHE_WRITE_BACK 0
+#define PAGING_CACHE_WRITE_COMBINING 1
+#define PAGING_CACHE_UNCACHED 3
+
+//builds the page directory from the memory map and enables paging.
+//returns 0 on success, or -1 if the CPU lacks 4 MiB pages (paging stays
+//off and all addresses remain physical).
+int paging_init(void);
+int paging_isEnabled(void);
+
+//returns nonzero if a virtual address is mapped (always if paging is off)
+int paging_isMapped(uint32_t address);
+
+//maps size bytes of device memory at physical address phys and returns
+//the virtual address, or 0 if the window or page tables are exhausted.
+//ranges of 4 MiB or more use large pages. mappings are permanent. if
+//paging is off, phys is returned unchanged and cacheType is ignored.
+void *paging_mapDevice(uint32_t phys, uint32_t size, uint32_t cacheType);
+
+#endif //PAGING_H
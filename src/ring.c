@@ -0,0 +1,65 @@
+/* J. Kent Wirant
+ * osmium
+ * ring.c
+ * Description: Lock-free single-producer/single-consumer byte ring for
+ *   passing data from an interrupt handler to the main loop (or back).
+ */
+
+#include "ring.h"
+#include "x86_util.h"
+
+void ring_init(struct Ring *ring, uint8_t *buffer, uint32_t capacity) {
+	ring->head = 0;
+	ring->tail = 0;
+	ring->mask = capacity - 1;
+	ring->data = buffer;
+	ring->dropped = 0;
+}
+
+int ring_push(struct Ring *ring, uint8_t value) {
+	uint32_t head = ring->head;
+	
+	if(head - ring->tail > ring->mask) {
+		ring->dropped++;
+		return 0;
+	}
+	
+	ring->data[head & ring->mask] = value;
+	X86_BARRIER();
+	ring->head = head + 1;
+	return 1;
+}
+
+int ring_pop(struct Ring *ring, uint8_t *value) {
+	uint32_t tail = ring->tail;
+	
+	if(tail == ring->head)
+		return 0;
+	
+	*value = ring->data[tail & ring->mask];
+	X86_BARRIER();
+	ring->tail = tail + 1;
+	return 1;
+}
+
+uint32_t ring_popBatch(struct Ring *ring, uint8_t *dest, uint32_t max) {
+	uint32_t tail = ring->tail;
+	uint32_t count = ring->head - tail;
+	
+	if(count > max)
+		count = max;
+	
+	X86_BARRIER(); //read head before the data it publishes
+	
+	for(uint32_t i = 0; i < count; i++) {
+		dest[i] = ring->data[(tail + i) & ring->mask];
+	}
+	
+	X86_BARRIER();
+	ring->tail = tail + count;
+	return count;
+}
+
+uint32_t ring_count(const struct Ring *ring) {
+	return ring->head - ring->tail;
+}
@@ -0,0 +1,37 @@
+/* J. Kent Wirant
+ * osmium
+ * ring.h
+ * Description: Lock-free single-producer/single-consumer byte ring for
+ *   passing data from an interrupt handler to the main loop (or back).
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+
+//head is only written by the producer and tail only by the consumer, so
+//neither side needs to disable interrupts. indices run freely and are
+//masked on access; the capacity must be a power of two.
+struct Ring {
+	volatile uint32_t head;
+	volatile uint32_t tail;
+	uint32_t mask; //capacity - 1
+	uint8_t *data;
+	uint32_t dropped; //pushes that found the ring full (producer side)
+};
+
+void ring_init(struct Ring *ring, uint8_t *buffer, uint32_t capacity);
+
+//producer: returns 0 and counts a drop if the ring is full
+int ring_push(struct Ring *ring, uint8_t value);
+
+//consumer: returns 0 if the ring is empty
+int ring_pop(struct Ring *ring, uint8_t *value);
+
+//consumer: copies up to max bytes, returns the number copied
+uint32_t ring_popBatch(struct Ring *ring, uint8_t *dest, uint32_t max);
+
+uint32_t ring_count(const struct Ring *ring);
+
+#endif //RING_H
@@ -0,0 +1,180 @@
+/* J. Kent Wirant
+ * osmium
+ * serial.c
+ * Description: 16550 UART driver for the first serial port (COM1).
+ *   Normal input and output go through interrupt-driven rings and never
+ *   block; serial_putc()/serial_write() poll instead, for diagnostics
+ *   that must work even when interrupts cannot be trusted.
+ */
+
+//referenced https://wiki.osdev.org/Serial_Ports
+
+#include "serial.h"
+#include "interrupts.h"
+#include "ring.h"
+#include "x86_util.h"
+
+#define COM1 0x3F8
+#define COM1_IRQ 4
+
+//register offsets
+#define UART_DATA 0 //divisor low byte when DLAB is set
+#define UART_IER 1 //divisor high byte when DLAB is set
+#define UART_IIR 2 //read
+#define UART_FCR 2 //write
+#define UART_LCR 3
+#define UART_MCR 4
+#define UART_LSR 5
+#define UART_MSR 6
+#define UART_SCRATCH 7
+
+#define IER_RX_AVAILABLE 0x01
+#define IER_TX_EMPTY 0x02
+
+#define IIR_NONE_PENDING 0x01
+#define IIR_ID_MASK 0x0E
+#define IIR_MODEM_STATUS 0x00
+#define IIR_TX_EMPTY 0x02
+#define IIR_RX_AVAILABLE 0x04
+#define IIR_LINE_STATUS 0x06
+#define IIR_RX_TIMEOUT 0x0C
+#define IIR_FIFO_ENABLED 0xC0
+
+#define FCR_ENABLE_CLEAR_14 0xC7 //enable and clear FIFOs, RX trigger 14 bytes
+
+#define LCR_8N1 0x03
+#define LCR_DLAB 0x80
+#define MCR_DTR_RTS_OUT2 0x0B //OUT2 gates the IRQ line
+
+#define LSR_DATA_READY 0x01
+#define LSR_THR_EMPTY 0x20
+
+#define BAUD_DIVISOR 1 //115200 / 1
+#define TX_RING_SIZE 2048 //power of two
+#define RX_RING_SIZE 256
+#define FIFO_SIZE 16 //16550A; 1 without a working FIFO
+
+static int present = 0;
+static uint32_t fifoSize = 1;
+
+static uint8_t txBuffer[TX_RING_SIZE];
+static uint8_t rxBuffer[RX_RING_SIZE];
+static struct Ring txRing; //main loop -> IRQ handler
+static struct Ring rxRing; //IRQ handler -> main loop
+
+int serial_init(void) {
+	//a missing port reads back as 0xFF
+	x86_outb(COM1 + UART_SCRATCH, 0x5A);
+	if(x86_inb(COM1 + UART_SCRATCH) != 0x5A)
+		return -1;
+	
+	x86_outb(COM1 + UART_IER, 0x00); //no interrupts yet
+	x86_outb(COM1 + UART_LCR, LCR_DLAB);
+	x86_outb(COM1 + UART_DATA, BAUD_DIVISOR & 0xFF);
+	x86_outb(COM1 + UART_IER, BAUD_DIVISOR >> 8);
+	x86_outb(COM1 + UART_LCR, LCR_8N1);
+	x86_outb(COM1 + UART_FCR, FCR_ENABLE_CLEAR_14);
+	x86_outb(COM1 + UART_MCR, MCR_DTR_RTS_OUT2);
+	
+	//older UARTs (8250, 16450, buggy 16550) have no usable FIFO
+	if((x86_inb(COM1 + UART_IIR) & IIR_FIFO_ENABLED) == IIR_FIFO_ENABLED)
+		fifoSize = FIFO_SIZE;
+	
+	ring_init(&txRing, txBuffer, TX_RING_SIZE);
+	ring_init(&rxRing, rxBuffer, RX_RING_SIZE);
+	present = 1;
+	return 0;
+}
+
+int serial_isPresent(void) {
+	return present;
+}
+
+void serial_enableInterrupts(void) {
+	if(!present)
+		return;
+	
+	x86_outb(COM1 + UART_IER, IER_RX_AVAILABLE);
+	pic_enableIrq(COM1_IRQ);
+}
+
+uint32_t serial_send(const char *data, uint32_t length) {
+	uint32_t sent = 0;
+	
+	if(!present)
+		return 0;
+	
+	while(sent < length && ring_push(&txRing, data[sent])) {
+		sent++;
+	}
+	
+	//the UART raises a TX-empty interrupt as soon as it is enabled if the
+	//transmitter is idle, which starts the transfer
+	if(sent > 0)
+		x86_outb(COM1 + UART_IER, IER_RX_AVAILABLE | IER_TX_EMPTY);
+	
+	return sent;
+}
+
+uint32_t serial_receive(uint8_t *dest, uint32_t max) {
+	return ring_popBatch(&rxRing, dest, max);
+}
+
+//refills the FIFO from the ring, or stops TX interrupts once it is empty
+static void transmit(void) {
+	uint8_t data;
+	
+	for(uint32_t i = 0; i < fifoSize; i++) {
+		if(!ring_pop(&txRing, &data)) {
+			x86_outb(COM1 + UART_IER, IER_RX_AVAILABLE);
+			return;
+		}
+		
+		x86_outb(COM1 + UART_DATA, data);
+	}
+}
+
+uint32_t serial_interrupt(void) {
+	uint32_t received = 0;
+	uint8_t iir;
+	
+	//the UART reports one cause at a time, highest priority first
+	while(!((iir = x86_inb(COM1 + UART_IIR)) & IIR_NONE_PENDING)) {
+		switch(iir & IIR_ID_MASK) {
+			case IIR_RX_AVAILABLE:
+			case IIR_RX_TIMEOUT:
+				while(x86_inb(COM1 + UART_LSR) & LSR_DATA_READY) {
+					ring_push(&rxRing, x86_inb(COM1 + UART_DATA));
+					received++;
+				}
+				break;
+			case IIR_TX_EMPTY:
+				transmit();
+				break;
+			case IIR_LINE_STATUS:
+				x86_inb(COM1 + UART_LSR); //clears the error
+				break;
+			case IIR_MODEM_STATUS:
+				x86_inb(COM1 + UART_MSR);
+				break;
+		}
+	}
+	
+	return received;
+}
+
+void serial_putc(char c) {
+	if(!present)
+		return;
+	
+	while((x86_inb(COM1 + UART_LSR) & LSR_THR_EMPTY) == 0);
+	x86_outb(COM1 + UART_DATA, c);
+}
+
+void serial_write(const char *str) {
+	while(*str) {
+		if(*str == '\n')
+			serial_putc('\r');
+		serial_putc(*str++);
+	}
+}
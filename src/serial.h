@@ -0,0 +1,39 @@
+/* J. Kent Wirant
+ * osmium
+ * serial.h
+ * Description: 16550 UART driver for the first serial port (COM1).
+ *   Normal input and output go through interrupt-driven rings and never
+ *   block; serial_putc()/serial_write() poll instead, for diagnostics
+ *   that must work even when interrupts cannot be trusted.
+ */
+
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stdint.h>
+
+//115200 baud, 8 data bits, no parity, 1 stop bit, FIFOs enabled; returns
+//-1 if no UART answers at the port
+int serial_init(void);
+int serial_isPresent(void);
+
+//starts interrupt-driven I/O (the caller installs isr_serial at the
+//vector for IRQ4)
+void serial_enableInterrupts(void);
+
+//queues up to length bytes for transmission and returns how many fit;
+//never waits for the UART
+uint32_t serial_send(const char *data, uint32_t length);
+
+//copies up to max received bytes, returns the number copied
+uint32_t serial_receive(uint8_t *dest, uint32_t max);
+
+//called by the IRQ4 handler; returns the number of bytes received
+uint32_t serial_interrupt(void);
+
+//polled output: busy-waits for room in the transmitter; does nothing
+//without a UART
+void serial_putc(char c);
+void serial_write(const char *str);
+
+#endif //SERIAL_H
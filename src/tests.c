@@ -11,6 +11,37 @@
 #include "interrupts.h"
 #include "isr.h"
 #include "keyboard.h"
+#include "hex_format.h"
+#include "x86_util.h"
+#include "heap.h"
+#include "timer.h"
+#include "driver_pci.h"
+#include "apic.h"
+
+//clears the screen and prints one line: "name: passText." (or MISMATCH if
+//there were errors), then each measurement as "label: 0x########". tests
+//may print details on the following lines.
+static void report(const char *name, int errors, const char *passText,
+  int count, const char *const *labels, const uint32_t *values) {
+	char str[9];
+	
+	clearScreen();
+	setCursorPosition(0, 0);
+	printRaw(name);
+	printRaw(": ");
+	printRaw(errors == 0 ? passText : "MISMATCH");
+	printRaw(".");
+	
+	for(int i = 0; i < count; i++) {
+		printRaw(" ");
+		printRaw(labels[i]);
+		printRaw(": 0x");
+		intToHexStr(str, values[i], 8);
+		printRaw(str);
+	}
+	
+	flushDisplay();
+}
 
 void test_textUtils1(void) {
 	const char *str1 = "Text Utilities Test: ";
@@ -31,6 +62,7 @@ void test_textUtils1(void) {
 	setTextColor(COLOR_RED, COLOR_BLACK);
 	setCursorPosition(NUM_ROWS - 1, NUM_COLS - strlen(str4));
 	printRaw(str4);
+	flushDisplay();
 }
 
 void test_interrupts1(void) {
@@ -51,6 +83,7 @@ void test_keyboard1_handler(uint8_t c, uint8_t keyCode, uint16_t flags) {
 	str[0] = c;
 	str[1] = 0;
 	printRaw(str);
+	flushDisplay();
 }
 
 void test_keyboard1_handler2(uint8_t c, uint8_t keyCode, uint16_t flags) {
@@ -66,6 +99,7 @@ void test_keyboard1_handler2(uint8_t c, uint8_t keyCode, uint16_t flags) {
 	*/
 	
 	printRaw(str);
+	flushDisplay();
 }
 
 void test_keyboard1(void) {
@@ -75,4 +109,539 @@ void test_keyboard1(void) {
 	setCursorPosition(0, 0);
 	pic_init();
 	keyboard_init(test_keyboard1_handler2);
+	
+	//the handler runs from here, not from the interrupt
+	while(1) {
+		keyboard_processInput();
+	}
+}
+
+//hold an arrow key: each line shows a key and how many typematic
+//repeats were coalesced into it since the last batch
+void test_keyboard2(void) {
+	struct KeyEvent keys[8];
+	char str[16];
+	
+	clearScreen();
+	setInterruptDescriptor(isr_timer, 0x20, 0);
+	setInterruptDescriptor(isr_keyboard, 0x21, 0);
+	loadIdt();
+	setCursorPosition(0, 0);
+	pic_init();
+	timer_init();
+	keyboard_init(0);
+	
+	while(1) {
+		uint32_t count = keyboard_readBatch(keys, 8);
+		
+		for(uint32_t i = 0; i < count; i++) {
+			intToHexStr(str, keys[i].c, 2);
+			str[2] = ' ';
+			str[3] = 'x';
+			intToHexStr(&str[4], keys[i].count, 4);
+			str[8] = ' ';
+			str[9] = 0;
+			printRaw(str);
+		}
+		
+		if(count > 0)
+			flushDisplay();
+		
+		timer_delayNs(100000000ULL); //let repeats pile up between batches
+	}
+}
+
+//shift+H, i, up arrow, print screen, pause, enter in both scan code sets;
+//print screen and pause have no character so only 5 keys come out
+static const uint8_t replaySet1[] = {
+	0x2A, 0x23, 0xA3, 0xAA, 0x17, 0x97, 0xE0, 0x48, 0xE0, 0xC8,
+	0xE0, 0x2A, 0xE0, 0x37, 0xE0, 0xB7, 0xE0, 0xAA,
+	0xE1, 0x1D, 0x45, 0xE1, 0x9D, 0xC5, 0x1C, 0x9C
+};
+
+static const uint8_t replaySet2[] = {
+	0x12, 0x33, 0xF0, 0x33, 0xF0, 0x12, 0x43, 0xF0, 0x43,
+	0xE0, 0x75, 0xE0, 0xF0, 0x75,
+	0xE0, 0x12, 0xE0, 0x7C, 0xE0, 0xF0, 0x7C, 0xE0, 0xF0, 0x12,
+	0xE1, 0x14, 0x77, 0xE1, 0xF0, 0x14, 0xF0, 0x77, 0x5A, 0xF0, 0x5A
+};
+
+static const uint8_t replayExpected[] = { 0x03, 'H', 'i', KEY_UP, '\n' };
+
+//CAPS on, o, ;, shift+' (in Dvorak: O, ;, "), CAPS off, o
+static const uint8_t replayDvorak[] = {
+	0x3A, 0xBA, 0x1F, 0x9F, 0x2C, 0xAC, 0x36, 0x10, 0x90, 0xB6,
+	0x3A, 0xBA, 0x1F, 0x9F
+};
+
+static const uint8_t replayDvorakExpected[] = { 0x06, 'O', ';', 0x04, '"', 0x06, 'o' };
+
+//returns the number of keys that differ from expected
+static int replayKeys(const uint8_t *bytes, uint32_t length,
+  const uint8_t *expected, uint32_t count) {
+	struct KeyEvent keys[16];
+	uint32_t n;
+	int errors = 0;
+	
+	keyboard_replay(bytes, length);
+	n = keyboard_readBatch(keys, 16);
+	
+	if(n != count)
+		return 1 + (n > count ? n - count : count - n);
+	
+	for(uint32_t i = 0; i < n; i++) {
+		if(keys[i].c != expected[i])
+			errors++;
+	}
+	
+	return errors;
+}
+
+//replays recorded scan code streams through the decoder, checks the keys
+//that come out and prints the average cycles per byte decoded
+void test_keyboard3(void) {
+	const int iterations = 4096;
+	uint32_t cycles;
+	uint64_t start;
+	int errors = 0;
+	
+	keyboard_init(0);
+	
+	errors += replayKeys(replaySet1, sizeof(replaySet1), replayExpected, sizeof(replayExpected));
+	keyboard_setScanCodeSet(2);
+	errors += replayKeys(replaySet2, sizeof(replaySet2), replayExpected, sizeof(replayExpected));
+	keyboard_setScanCodeSet(1);
+	keyboard_setLayout(KEYBOARD_LAYOUT_DVORAK);
+	errors += replayKeys(replayDvorak, sizeof(replayDvorak),
+	  replayDvorakExpected, sizeof(replayDvorakExpected));
+	keyboard_setLayout(KEYBOARD_LAYOUT_US);
+	
+	keyboard_setScanCodeSet(2);
+	start = x86_rdtsc();
+	for(int i = 0; i < iterations; i++) {
+		struct KeyEvent keys[16];
+		keyboard_replay(replaySet2, sizeof(replaySet2));
+		keyboard_readBatch(keys, 16);
+	}
+	cycles = (uint32_t)(x86_rdtsc() - start) / (iterations * sizeof(replaySet2));
+	keyboard_setScanCodeSet(1);
+	
+	report("keyboard", errors, "replay matches", 1, (const char *[]) {"cycles/byte"}, &cycles);
+}
+
+//formats a row the way the editor did before hex_format.c: one
+//intToHexStr() call and one range check per byte
+__attribute__((noinline))
+static void formatRowPerDigit(char *line, uint32_t address, const uint8_t *bytes) {
+	line[0] = ' ';
+	intToHexStr(&line[1], address, 8);
+	strncpy_safe(&line[8], "_ | ", 4);
+	
+	for(int i = 0; i < 16; i++) {
+		intToHexStr(&line[12 + 3 * i], bytes[i], 2);
+		line[14 + 3 * i] = ' ';
+		
+		if(bytes[i] >= 0x20 && bytes[i] < 0x7F) {
+			line[62 + i] = bytes[i];
+		}
+		else {
+			line[62 + i] = '.';
+		}
+	}
+	
+	line[60] = '|';
+	line[61] = ' ';
+	line[78] = ' ';
+	line[79] = ' ';
+	line[80] = 0;
+}
+
+//checks hexFormat_row() against the per-digit formatter for every byte
+//value, then prints the average cycle count per row of each
+void test_hexFormat1(void) {
+	const int iterations = 1024;
+	uint8_t bytes[16];
+	uint8_t parsed[16];
+	char oldLine[81];
+	char newLine[81];
+	int mismatches = 0;
+	uint32_t cycles[2];
+	uint64_t start;
+	
+	for(int i = 0; i < 256; i += 16) {
+		for(int j = 0; j < 16; j++) {
+			bytes[j] = i + j;
+		}
+		
+		formatRowPerDigit(oldLine, 0x7000 + i, bytes);
+		hexFormat_row(newLine, 0x7000 + i, bytes);
+		
+		if(strncmp(oldLine, newLine, 81) != 0)
+			mismatches++;
+		
+		//the hex portion of a row parses back to the same bytes (compared
+		//one by one: the first row holds a zero byte)
+		if(hexFormat_parse(parsed, 16, &newLine[12], 48) != 16) {
+			mismatches++;
+		}
+		else {
+			for(int j = 0; j < 16; j++) {
+				if(parsed[j] != bytes[j]) {
+					mismatches++;
+					break;
+				}
+			}
+		}
+	}
+	
+	start = x86_rdtsc();
+	for(int i = 0; i < iterations; i++) {
+		formatRowPerDigit(oldLine, i * 16, bytes);
+	}
+	cycles[0] = (uint32_t)(x86_rdtsc() - start) / iterations;
+	
+	start = x86_rdtsc();
+	for(int i = 0; i < iterations; i++) {
+		hexFormat_row(newLine, i * 16, bytes);
+	}
+	cycles[1] = (uint32_t)(x86_rdtsc() - start) / iterations;
+	
+	report("hexFormat", mismatches, "output matches", 2,
+	  (const char *[]) {"cycles/row per-digit", "table"}, cycles);
+}
+
+//random mix of small objects and occasional large blocks, freed in a
+//different order than allocated; prints cycles per kmalloc/kfree pair and
+//how much of the slab memory held at the peak was in use
+void test_heap1(void) {
+	const int count = 512;
+	const int rounds = 16;
+	static void *objects[512];
+	static uint32_t sizes[512];
+	struct HeapStats stats;
+	uint32_t seed = 12345;
+	uint32_t operations = 0;
+	uint32_t utilization = 0;
+	uint32_t cycles;
+	uint64_t start;
+	int failures = 0;
+	char str[4];
+	
+	start = x86_rdtsc();
+	for(int r = 0; r < rounds; r++) {
+		for(int i = 0; i < count; i++) {
+			seed = seed * 1103515245 + 12345; //LCG
+			sizes[i] = ((seed >> 16) & 0x1F) == 0 ? 
+			  ((seed >> 8) & 0x1FFF) + 1 : ((seed >> 8) & 0xFF) + 1;
+			objects[i] = kmalloc(sizes[i]);
+			if(objects[i] == 0) failures++;
+			else *(uint8_t *) objects[i] = (uint8_t) i;
+		}
+		
+		if(r == rounds - 1) {
+			heap_getStats(&stats);
+			if(stats.slabFrames > 0) //bytes * 100 / (frames * 4096)
+				utilization = (stats.slabBytesUsed * 25) / (stats.slabFrames * 1024);
+		}
+		
+		//free odd indices first, then even ones
+		for(int i = 1; i < count; i += 2) {
+			if(objects[i] && *(uint8_t *) objects[i] != (uint8_t) i) failures++;
+			kfree(objects[i]);
+		}
+		for(int i = 0; i < count; i += 2) {
+			if(objects[i] && *(uint8_t *) objects[i] != (uint8_t) i) failures++;
+			kfree(objects[i]);
+		}
+		
+		operations += count;
+	}
+	cycles = (uint32_t)(x86_rdtsc() - start) / operations;
+	
+	report("heap", failures, "ok", 1, (const char *[]) {"cycles per kmalloc+kfree"}, &cycles);
+	setCursorPosition(1, 0);
+	printRaw("slab use at peak (%): ");
+	intToDecStr(str, utilization, 3);
+	printRaw(str);
+	flushDisplay();
+}
+
+//reads the configuration space of 0:0.0 through both mechanisms, checks
+//that they agree, and prints the average cycles per dword read of each
+//(ECAM shows 0 cycles if the firmware has no MCFG table)
+void test_pci1(void) {
+	const int iterations = 1024;
+	uint32_t cycles[2] = {0, 0}; //legacy, ECAM
+	uint32_t legacy[64];
+	int mismatches = 0;
+	uint64_t start;
+	uint8_t method = pciGetAccessMethod();
+	
+	pciSetAccessMethod(PCI_ACCESS_LEGACY);
+	for(int i = 0; i < 64; i++) {
+		legacy[i] = pciConfigReadInt32(0, 0, 0, i * 4);
+	}
+	
+	start = x86_rdtsc();
+	for(int i = 0; i < iterations; i++) {
+		pciConfigReadInt32(0, 0, 0, (i & 63) * 4);
+	}
+	cycles[0] = (uint32_t)(x86_rdtsc() - start) / iterations;
+	
+	if(pciSetAccessMethod(PCI_ACCESS_ECAM) == 0) {
+		for(int i = 0; i < 64; i++) {
+			if(pciConfigReadInt32(0, 0, 0, i * 4) != legacy[i])
+				mismatches++;
+		}
+		
+		//narrow reads must match the bytes of the dword
+		if(pciConfigReadInt16(0, 0, 0, PCI_HDR_DEVICE_ID) != (legacy[0] >> 16) ||
+		  pciConfigReadInt8(0, 0, 0, PCI_HDR_CLASS_CODE) != (legacy[2] >> 24))
+			mismatches++;
+		
+		start = x86_rdtsc();
+		for(int i = 0; i < iterations; i++) {
+			pciConfigReadInt32(0, 0, 0, (i & 63) * 4);
+		}
+		cycles[1] = (uint32_t)(x86_rdtsc() - start) / iterations;
+	}
+	
+	pciSetAccessMethod(method);
+	
+	report("pci", mismatches, "ECAM matches legacy", 2,
+	  (const char *[]) {"cycles/read legacy", "ECAM"}, cycles);
+}
+
+//the brute-force scan that pciEnumerate() used to do: every device slot
+//of every bus
+static uint16_t enumerateAllBuses(uint16_t *functionList, uint16_t max) {
+	uint16_t count = 0;
+	
+	for(int bus = 0; bus < 256; bus++) {
+		for(int dev = 0; dev < 32; dev++) {
+			for(int fn = 0; fn < 8; fn++) {
+				if(!pciDeviceExists(bus, dev, fn)) {
+					if(fn == 0) break;
+					continue;
+				}
+				
+				if(count < max)
+					functionList[count++] = bus << 8 | dev << 3 | fn;
+				
+				if(fn == 0 && (pciConfigReadInt8(bus, dev, 0, PCI_HDR_HEADER_TYPE) & 0x80) == 0)
+					break;
+			}
+		}
+	}
+	
+	return count;
+}
+
+//checks that the bridge-following scan finds every function the
+//brute-force scan finds, and prints the cycles each takes
+void test_pci2(void) {
+	static uint16_t all[256];
+	static uint16_t found[256];
+	uint16_t allCount;
+	uint16_t foundCount;
+	uint32_t cycles[2]; //all buses, bridges
+	int missing = 0;
+	uint64_t start;
+	
+	start = x86_rdtsc();
+	allCount = enumerateAllBuses(all, 256);
+	cycles[0] = (uint32_t)(x86_rdtsc() - start);
+	
+	start = x86_rdtsc();
+	foundCount = pciEnumerate(found, 256);
+	cycles[1] = (uint32_t)(x86_rdtsc() - start);
+	
+	for(int i = 0; i < allCount; i++) {
+		int j = 0;
+		while(j < foundCount && found[j] != all[i]) j++;
+		if(j == foundCount) missing++;
+	}
+	
+	if(allCount != foundCount)
+		missing++;
+	
+	report("pciEnumerate", missing, "same functions", 2,
+	  (const char *[]) {"cycles all buses", "bridges"}, cycles);
+}
+
+//every registry entry must be reachable through both hash indexes and
+//hold the same header the hardware reports
+void test_pci3(void) {
+	uint16_t count = pciGetDeviceCount();
+	int errors = 0;
+	
+	for(uint16_t i = 0; i < count; i++) {
+		const struct PciDevice *dev = pciGetDevice(i);
+		const struct PciDevice *match = 0;
+		
+		if(dev->table.vendorId != pciConfigReadInt16(dev->bus, dev->device, dev->function, PCI_HDR_VENDOR_ID) ||
+		  dev->table.headerType != pciConfigReadInt8(dev->bus, dev->device, dev->function, PCI_HDR_HEADER_TYPE))
+			errors++;
+		
+		do {
+			match = pciFindById(dev->table.vendorId, dev->table.deviceId, match);
+		} while(match != 0 && match != dev);
+		if(match != dev) errors++;
+		
+		match = 0;
+		do {
+			match = pciFindByClass(dev->table.classCode, dev->table.subclass, dev->table.progIf, match);
+		} while(match != 0 && match != dev);
+		if(match != dev) errors++;
+	}
+	
+	report("pci registry", errors, "indexes match", 0, 0, 0);
+}
+
+//bulk writes through a prefetchable BAR (e.g. a framebuffer), mapped
+//write-combining by pciMapBar. the sample is copied out first and the
+//same data written back, so a live framebuffer is left unchanged. the
+//mapping is made once and reused, since mappings are never released.
+void test_pci4(void) {
+	static uint32_t saved[0x4000 / 4];
+	static const struct PciDevice *mappedDev = 0;
+	static int mappedIndex = 0;
+	static volatile uint32_t *mapped = 0;
+	const uint32_t sample = sizeof(saved); //bytes written per pass
+	uint16_t count = pciGetDeviceCount();
+	const struct PciDevice *target = 0;
+	int index = 0;
+	int errors = 0;
+	uint32_t cycles;
+	uint64_t start;
+	
+	for(uint16_t i = 0; i < count; i++) {
+		const struct PciDevice *dev = pciGetDevice(i);
+		
+		for(int j = 0; j < PCI_MAX_BARS; j++) {
+			const struct PciBar *bar = &dev->bars[j];
+			uint32_t raw;
+			
+			if(bar->size == 0) continue;
+			
+			raw = pciConfigReadInt32(dev->bus, dev->device, dev->function, PCI_HDR0_BAR0 + 4 * j);
+			if((bar->size & (bar->size - 1)) != 0) errors++; //must be a power of 2
+			if((uint32_t) bar->base != (raw & ((bar->flags & PCI_BAR_IO) ? ~0x3 : ~0xF))) errors++;
+			
+			if(target == 0 && (bar->flags & PCI_BAR_PREFETCHABLE) && bar->size >= sample &&
+			  ((bar->base + bar->size - 1) >> 32) == 0) {
+				target = dev;
+				index = j;
+			}
+		}
+	}
+	
+	if(target == 0) {
+		report("pci bars", errors, "registry matches", 0, 0, 0);
+		setCursorPosition(1, 0);
+		printRaw("no prefetchable BAR to test");
+		flushDisplay();
+		return;
+	}
+	
+	if(mapped == 0 || mappedDev != target || mappedIndex != index) {
+		mapped = pciMapBar(target, index);
+		mappedDev = target;
+		mappedIndex = index;
+	}
+	
+	if(mapped == 0) { //the device window is full
+		report("pci bars", errors, "registry matches", 0, 0, 0);
+		setCursorPosition(1, 0);
+		printRaw("pciMapBar failed");
+		flushDisplay();
+		return;
+	}
+	
+	for(uint32_t i = 0; i < sample / 4; i++) saved[i] = mapped[i];
+	
+	start = x86_rdtsc();
+	for(uint32_t i = 0; i < sample / 4; i++) mapped[i] = saved[i];
+	asm volatile ("sfence" ::: "memory"); //drain the WC buffers
+	cycles = (uint32_t)(x86_rdtsc() - start) / (sample / 1024);
+	
+	report("pci bars", errors, "registry matches", 1, (const char *[]) {"WC cycles/KiB"}, &cycles);
+}
+
+//walks every function's capability lists, then moves the first function
+//that supports MSI-X or MSI onto dedicated vectors and back to INTx
+void test_pci5(void) {
+	static void (*const isrs[4])(struct interrupt_frame *) = {
+		isr_msiTest, isr_msiTest, isr_msiTest, isr_msiTest
+	};
+	uint16_t count = pciGetDeviceCount();
+	const struct PciDevice *target = 0;
+	uint32_t counts[3] = {0, 0, 0}; //MSI, MSI-X, extended
+	int errors = 0;
+	int granted;
+	char str[6];
+	
+	for(uint16_t i = 0; i < count; i++) {
+		const struct PciDevice *dev = pciGetDevice(i);
+		uint16_t cap = 0;
+		
+		for(int id = 0; id < 0x20; id++) {
+			while((cap = pciFindCapability(dev, id, cap)) != 0) {
+				if(pciConfigReadInt8(dev->bus, dev->device, dev->function, cap) != id) errors++;
+				if(id == PCI_CAP_ID_MSI) counts[0]++;
+				if(id == PCI_CAP_ID_MSIX) counts[1]++;
+			}
+		}
+		
+		for(int id = 0; id < 0x30; id++) {
+			while((cap = pciFindExtendedCapability(dev, id, cap)) != 0) {
+				counts[2]++;
+			}
+		}
+		
+		if(target == 0 && (pciFindCapability(dev, PCI_CAP_ID_MSIX, 0) ||
+		  pciFindCapability(dev, PCI_CAP_ID_MSI, 0)))
+			target = dev;
+	}
+	
+	report("pci caps", errors, "lists match", 3, (const char *[]) {"MSI", "MSI-X", "extended"}, counts);
+	errors = 0;
+	
+	setCursorPosition(1, 0);
+	if(target == 0 || !apic_isEnabled()) {
+		printRaw("no MSI capable function or no local APIC");
+		flushDisplay();
+		return;
+	}
+	
+	granted = pciEnableMsi(target, isrs, 4);
+	if(granted <= 0) {
+		printRaw("pciEnableMsi failed");
+		flushDisplay();
+		return;
+	}
+	
+	//the function must now send the vector it was given
+	if(target->irqMode == PCI_IRQ_MSIX) {
+		if(target->msixTable[2] != target->irqVector) errors++;
+	}
+	else {
+		uint16_t cap = pciFindCapability(target, PCI_CAP_ID_MSI, 0);
+		uint16_t control = pciConfigReadInt16(target->bus, target->device, target->function, cap + PCI_MSI_CONTROL);
+		uint16_t data = pciConfigReadInt16(target->bus, target->device, target->function,
+		  cap + ((control & PCI_MSI_CONTROL_64BIT) ? PCI_MSI_DATA_64 : PCI_MSI_DATA_32));
+		if(data != target->irqVector) errors++;
+	}
+	
+	printRaw(target->irqMode == PCI_IRQ_MSIX ? "MSI-X" : "MSI");
+	printRaw(" vectors: ");
+	intToHexStr(str, target->irqVector, 2);
+	str[2] = '+';
+	intToHexStr(str + 3, granted, 2);
+	printRaw(str);
+	
+	pciDisableMsi(target);
+	if(target->irqMode != PCI_IRQ_INTX) errors++;
+	printRaw(errors == 0 ? " ok" : " MISMATCH");
+	flushDisplay();
 }
@@ -12,5 +12,14 @@ void test_textUtils1(void);
 void test_interrupts1(void);
 void test_pic1(void);
 void test_keyboard1(void);
+void test_keyboard2(void);
+void test_keyboard3(void);
+void test_hexFormat1(void);
+void test_heap1(void);
+void test_pci1(void);
+void test_pci2(void);
+void test_pci3(void);
+void test_pci4(void);
+void test_pci5(void);
 
 #endif //TESTS_H
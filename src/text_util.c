@@ -12,6 +12,13 @@
 static short *VIDEO_TEXT = (short *)0x000B8000;
 static const int VIDEO_TEXT_LENGTH = NUM_COLS * NUM_ROWS * 2;
 
+//Writes to video memory are slow on real hardware, so all drawing goes to
+//backBuffer. frontBuffer mirrors what is currently in video memory, which
+//lets flushDisplay() skip every cell that did not actually change.
+static short backBuffer[TEXT_CELL_COUNT];
+static short frontBuffer[TEXT_CELL_COUNT];
+static uint32_t dirtyRows = 0; //bit n is set if row n was drawn to
+
 //consider saving state as a struct to allow multiple display instances
 static char bgColor = COLOR_BLACK; //background
 static char fgColor = COLOR_WHITE; //foreground
@@ -33,32 +40,56 @@ void setTextColor(char foreground, char background) {
 	fgColor = foreground;
 }
 
+static void markDirty(int firstCell, int lastCell) {
+	int firstRow = firstCell / NUM_COLS;
+	int lastRow = lastCell / NUM_COLS;
+	
+	for(int row = firstRow; row <= lastRow; row++) {
+		dirtyRows |= 1UL << row;
+	}
+}
+
 void printRaw(const char *str) {
 	char color = bgColor << 4 | fgColor;
+	int start = cursorPos;
 	
 	while(*str && cursorPos < VIDEO_TEXT_LENGTH / 2) {
-		VIDEO_TEXT[cursorPos] = color << 8 | *str;
+		backBuffer[cursorPos] = color << 8 | *str;
 		str++;
 		cursorPos++;
 	}
+	
+	if(cursorPos > start) {
+		markDirty(start, cursorPos - 1);
+	}
 }
 
-void highlight(char row, char col) {
+static void removeHighlight(void) {
 	char color;
 	
-	//de-highlight if applicable
 	if(highlightPos >= 0 && highlightPos < VIDEO_TEXT_LENGTH / 2) {
 		color = bgColor << 4 | fgColor;
-		VIDEO_TEXT[highlightPos] &= 0x00FF; //clear color
-		VIDEO_TEXT[highlightPos] |= color << 8; //set color
+		backBuffer[highlightPos] &= 0x00FF; //clear color
+		backBuffer[highlightPos] |= color << 8; //set color
+		markDirty(highlightPos, highlightPos);
 	}
 	
+	highlightPos = -1;
+}
+
+void highlight(char row, char col) {
+	char color;
+	
+	//de-highlight if applicable
+	removeHighlight();
+	
 	//highlight new position if possible
 	if(row >= 0 && row < NUM_ROWS && col >= 0 && col < NUM_COLS) {
 		color = fgColor << 4 | bgColor; //invert colors
 		highlightPos = row * NUM_COLS + col;
-		VIDEO_TEXT[highlightPos] &= 0x00FF; //clear color
-		VIDEO_TEXT[highlightPos] |= color << 8; //set color
+		backBuffer[highlightPos] &= 0x00FF; //clear color
+		backBuffer[highlightPos] |= color << 8; //set color
+		markDirty(highlightPos, highlightPos);
 	}
 }
 
@@ -66,7 +97,68 @@ void clearScreen(void) {
 	char color = bgColor << 4 | fgColor;
 	int fillValue = color << 24 | ' ' << 16 | color << 8 | ' ';
 	
+	//all three copies are written so that they start out identical
 	for(int i = 0; i < VIDEO_TEXT_LENGTH / 4; i++) {
 		((int*)VIDEO_TEXT)[i] = fillValue;
+		((int*)backBuffer)[i] = fillValue;
+		((int*)frontBuffer)[i] = fillValue;
+	}
+	
+	dirtyRows = 0;
+}
+
+void flushDisplay(void) {
+	for(int row = 0; dirtyRows != 0; row++, dirtyRows >>= 1) {
+		if((dirtyRows & 1) == 0)
+			continue;
+		
+		//compare against frontBuffer instead of reading video memory back
+		for(int i = row * NUM_COLS; i < (row + 1) * NUM_COLS; i++) {
+			if(backBuffer[i] != frontBuffer[i]) {
+				frontBuffer[i] = backBuffer[i];
+				VIDEO_TEXT[i] = backBuffer[i];
+			}
+		}
+	}
+}
+
+void scrollRows(char firstRow, char count, char delta) {
+	int shift = (delta < 0) ? -delta : delta;
+	int first = firstRow * NUM_COLS / 2; //indices are in pairs of cells
+	int moved = (count - shift) * NUM_COLS / 2;
+	int offset = delta * NUM_COLS / 2;
+	int *back = (int *)backBuffer;
+	int *front = (int *)frontBuffer;
+	int *video = (int *)VIDEO_TEXT;
+	
+	if(firstRow < 0 || count <= 0 || firstRow + count > NUM_ROWS)
+		return;
+	
+	//the highlighted cell would otherwise move along with the text
+	removeHighlight();
+	
+	//afterwards, video memory matches both buffers
+	flushDisplay();
+	
+	if(shift >= count)
+		return;
+	
+	//Block move of the rows that stay visible. The header and footer stay in
+	//place, so the CRTC start address can't be used to pan the whole screen;
+	//the moved rows are written from frontBuffer, since reading video memory
+	//back is slower than writing it.
+	if(delta > 0) {
+		for(int i = first; i < first + moved; i++) {
+			back[i] = back[i + offset];
+			front[i] = front[i + offset];
+			video[i] = front[i];
+		}
+	}
+	else {
+		for(int i = first + moved - 1 - offset; i >= first - offset; i--) {
+			back[i] = back[i + offset];
+			front[i] = front[i + offset];
+			video[i] = front[i];
+		}
 	}
 }
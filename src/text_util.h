@@ -10,6 +10,10 @@
 #ifndef TEXT_UTIL_H
 #define TEXT_UTIL_H
 
+#include <stdint.h>
+
+#define TEXT_CELL_COUNT (80 * 25) //number of character cells on the screen
+
 static const char NUM_COLS = 80;
 static const char NUM_ROWS = 25;
 
@@ -36,6 +40,14 @@ void printRaw(const char *str);
 void highlight(char row, char col);
 
 void clearScreen(void);
+
+//drawing functions write to an off-screen copy of the display; this copies
+//only the cells that changed since the last flush to video memory.
+void flushDisplay(void);
+
+//moves rows [firstRow, firstRow + count) up by delta rows (down if delta is
+//negative). Rows exposed at the edge keep stale text until redrawn.
+void scrollRows(char firstRow, char count, char delta);
 //void printf(const char *fmt, ...);
 
 //char * itoa(int value, char *buf, int radix);
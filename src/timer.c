@@ -0,0 +1,196 @@
+/* J. Kent Wirant
+ * osmium
+ * timer.c
+ * Description: Time keeping. The PIT raises IRQ0 at TIMER_HZ to run
+ *   deadline timers, and the TSC, calibrated against the PIT at boot,
+ *   provides a monotonic nanosecond clock.
+ */
+
+//referenced https://wiki.osdev.org/Programmable_Interval_Timer
+
+#include "timer.h"
+#include "interrupts.h"
+#include "x86_util.h"
+
+#define PIT_FREQUENCY 1193182 //Hz
+#define PIT_CHANNEL0 0x40
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND 0x43
+#define PIT_GATE_PORT 0x61 //bit 0: channel 2 gate, bit 1: speaker, bit 5: OUT2
+
+#define PIT_DIVISOR ((PIT_FREQUENCY + TIMER_HZ / 2) / TIMER_HZ)
+#define TICK_NS ((uint32_t)((uint64_t) PIT_DIVISOR * 1000000000 / PIT_FREQUENCY))
+
+#define CALIBRATION_MS 50
+#define CALIBRATION_COUNT (PIT_FREQUENCY * CALIBRATION_MS / 1000)
+#define CALIBRATION_TIMEOUT 0x1000000 //port reads, about 16 s
+
+#define CPUID_EDX_TSC (1UL << 4)
+
+//TSC cycles are converted with fixed-point multipliers so no 64-bit
+//division is needed (there is no libgcc to provide one). the fraction
+//bits are chosen so each multiplier fits in 32 bits above 4 MHz.
+#define NS_SHIFT 24
+#define US_SHIFT 32
+
+static uint64_t tscStart = 0;
+static uint32_t tscKHz = 0;
+static uint32_t nsPerCycle = 0; //8.24 fixed point
+static uint32_t usPerCycle = 0; //0.32 fixed point
+
+static volatile uint32_t ticks = 0;
+static struct Timer *timers = 0; //sorted by deadline
+
+//quotient of a 64-bit dividend; the quotient must fit in 32 bits
+static uint32_t divide(uint64_t n, uint32_t d) {
+	uint32_t q, r;
+	asm ("divl %4" : "=a" (q), "=d" (r) : "a" ((uint32_t) n), "d" ((uint32_t)(n >> 32)), "rm" (d));
+	return q;
+}
+
+//cycles * multiplier >> shift, as two 32x32-bit products
+static uint64_t scale(uint64_t cycles, uint32_t multiplier, int shift) {
+	uint64_t high = (uint64_t)(uint32_t)(cycles >> 32) * multiplier;
+	uint64_t low = (uint64_t)(uint32_t) cycles * multiplier;
+	return (high << (32 - shift)) + (low >> shift);
+}
+
+//counts TSC cycles during a one-shot countdown of PIT channel 2, which
+//does not need interrupts; returns kHz, or 0 if the PIT never finished
+static uint32_t calibrateTsc(void) {
+	uint8_t gate = x86_inb(PIT_GATE_PORT);
+	uint64_t start, end;
+	uint32_t timeout = 0;
+	
+	x86_outb(PIT_GATE_PORT, (gate & ~0x02) | 0x01); //gate on, speaker off
+	x86_outb(PIT_COMMAND, 0xB0); //channel 2, lo/hi byte, mode 0
+	x86_outb(PIT_CHANNEL2, CALIBRATION_COUNT & 0xFF);
+	x86_outb(PIT_CHANNEL2, CALIBRATION_COUNT >> 8);
+	
+	start = x86_rdtsc();
+	while((x86_inb(PIT_GATE_PORT) & 0x20) == 0) {
+		if(++timeout == CALIBRATION_TIMEOUT) return 0;
+	}
+	end = x86_rdtsc();
+	
+	x86_outb(PIT_GATE_PORT, gate);
+	return (uint32_t)(end - start) / CALIBRATION_MS;
+}
+
+void timer_init(void) {
+	uint32_t regs[4];
+	
+	x86_cpuid(1, regs);
+	if(regs[3] & CPUID_EDX_TSC)
+		tscKHz = calibrateTsc();
+	
+	if(tscKHz < 4000) {
+		tscKHz = 0;
+	}
+	else {
+		nsPerCycle = divide((uint64_t) 1000000 << NS_SHIFT, tscKHz);
+		usPerCycle = divide((uint64_t) 1000 << US_SHIFT, tscKHz);
+		tscStart = x86_rdtsc();
+	}
+	
+	//channel 0, lo/hi byte, mode 2 (rate generator)
+	x86_outb(PIT_COMMAND, 0x34);
+	x86_outb(PIT_CHANNEL0, PIT_DIVISOR & 0xFF);
+	x86_outb(PIT_CHANNEL0, PIT_DIVISOR >> 8);
+	pic_enableIrq(0);
+}
+
+uint64_t timer_nowNs(void) {
+	if(tscKHz == 0)
+		return (uint64_t) ticks * TICK_NS;
+	
+	return scale(x86_rdtsc() - tscStart, nsPerCycle, NS_SHIFT);
+}
+
+uint64_t timer_nowUs(void) {
+	if(tscKHz == 0)
+		return (uint64_t) ticks * (TICK_NS / 1000);
+	
+	return scale(x86_rdtsc() - tscStart, usPerCycle, US_SHIFT);
+}
+
+uint32_t timer_nowMs(void) {
+	return timer_usToMs(timer_nowUs());
+}
+
+uint32_t timer_usToMs(uint64_t us) {
+	uint32_t high = us >> 32;
+	
+	//whole multiples of 1000 * 2^32 us only affect bits above 32
+	return divide(((uint64_t)(high % 1000) << 32) | (uint32_t) us, 1000);
+}
+
+uint32_t timer_getTscKHz(void) {
+	return tscKHz;
+}
+
+uint32_t timer_getTicks(void) {
+	return ticks;
+}
+
+void timer_delayNs(uint64_t ns) {
+	uint64_t end = timer_nowNs() + ns;
+	while(timer_nowNs() < end);
+}
+
+static void unlinkTimer(struct Timer *timer) {
+	struct Timer **link = &timers;
+	
+	while(*link && *link != timer) {
+		link = &(*link)->next;
+	}
+	
+	if(*link) *link = timer->next;
+	timer->active = 0;
+}
+
+void timer_set(struct Timer *timer, uint64_t deadline, void (*callback)(struct Timer *)) {
+	uint32_t flags = x86_disableInterrupts();
+	struct Timer **link = &timers;
+	
+	if(timer->active) unlinkTimer(timer);
+	
+	timer->deadline = deadline;
+	timer->callback = callback;
+	
+	while(*link && (*link)->deadline <= deadline) {
+		link = &(*link)->next;
+	}
+	
+	timer->next = *link;
+	*link = timer;
+	timer->active = 1;
+	
+	x86_restoreInterrupts(flags);
+}
+
+void timer_cancel(struct Timer *timer) {
+	uint32_t flags = x86_disableInterrupts();
+	if(timer->active) unlinkTimer(timer);
+	x86_restoreInterrupts(flags);
+}
+
+void timer_tick(void) {
+	struct Timer *timer;
+	uint64_t now;
+	
+	ticks++;
+	
+	if(timers == 0)
+		return;
+	
+	now = timer_nowNs();
+	
+	//callbacks may re-arm their timer, so each is unlinked first
+	while(timers && timers->deadline <= now) {
+		timer = timers;
+		timers = timer->next;
+		timer->active = 0;
+		timer->callback(timer);
+	}
+}
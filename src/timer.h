@@ -0,0 +1,52 @@
+/* J. Kent Wirant
+ * osmium
+ * timer.h
+ * Description: Time keeping. The PIT raises IRQ0 at TIMER_HZ to run
+ *   deadline timers, and the TSC, calibrated against the PIT at boot,
+ *   provides a monotonic nanosecond clock.
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+#define TIMER_HZ 1000
+
+//a one-shot timer; the structure is owned by the caller and must stay
+//valid until it fires or is cancelled
+struct Timer {
+	uint64_t deadline; //timer_nowNs() value at which the callback runs
+	void (*callback)(struct Timer *timer); //runs in the IRQ0 handler
+	struct Timer *next;
+	uint8_t active;
+};
+
+//calibrates the TSC and starts the PIT; interrupts must be set up (the
+//caller installs isr_timer at the PIC's IRQ0 vector)
+void timer_init(void);
+
+//nanoseconds since timer_init(); resolution is one TSC cycle if the TSC
+//was calibrated, otherwise one PIT tick
+uint64_t timer_nowNs(void);
+uint64_t timer_nowUs(void);
+uint32_t timer_nowMs(void); //wraps after 49 days
+
+//converts without 64-bit division; the result wraps like timer_nowMs()
+uint32_t timer_usToMs(uint64_t us);
+
+uint32_t timer_getTscKHz(void); //0 if the TSC is not used
+uint32_t timer_getTicks(void); //IRQ0 count
+
+//busy-waits for at least ns nanoseconds
+void timer_delayNs(uint64_t ns);
+
+//arms timer to call callback once timer_nowNs() reaches deadline (checked
+//every PIT tick); re-arming an active timer moves it
+void timer_set(struct Timer *timer, uint64_t deadline, void (*callback)(struct Timer *));
+void timer_cancel(struct Timer *timer);
+
+//called by the IRQ0 handler
+void timer_tick(void);
+
+#endif //TIMER_H
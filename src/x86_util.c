@@ -42,10 +42,89 @@ void x86_outd(uint16_t port, uint32_t data) {
 //referenced https://wiki.osdev.org/Model_Specific_Registers
 //read from model specific register 
 void x86_readMSR(uint32_t msr, uint32_t *lo, uint32_t *hi) {
-	asm volatile ("rdmsr" : "=a" (lo), "=d" (hi) : "c" (msr));
+	asm volatile ("rdmsr" : "=a" (*lo), "=d" (*hi) : "c" (msr));
 }
 
 //write to model specific register 
 void x86_writeMSR(uint32_t msr, uint32_t lo, uint32_t hi) {
 	asm volatile ("wrmsr" : : "a" (lo), "d" (hi), "c" (msr));
 }
+
+//read time stamp counter
+uint64_t x86_rdtsc(void) {
+	uint64_t tsc;
+	asm volatile ("rdtsc" : "=A" (tsc));
+	return tsc;
+}
+
+//referenced https://wiki.osdev.org/CPUID
+//processor identification; regs receives eax, ebx, ecx, edx
+void x86_cpuid(uint32_t leaf, uint32_t regs[4]) {
+	asm volatile ("cpuid" : "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), 
+	  "=d" (regs[3]) : "a" (leaf), "c" (0));
+}
+
+// control registers
+
+uint32_t x86_readCR0(void) {
+	uint32_t value;
+	asm volatile ("mov %%cr0, %0" : "=r" (value));
+	return value;
+}
+
+uint32_t x86_readCR2(void) {
+	uint32_t value;
+	asm volatile ("mov %%cr2, %0" : "=r" (value));
+	return value;
+}
+
+uint32_t x86_readCR3(void) {
+	uint32_t value;
+	asm volatile ("mov %%cr3, %0" : "=r" (value));
+	return value;
+}
+
+uint32_t x86_readCR4(void) {
+	uint32_t value;
+	asm volatile ("mov %%cr4, %0" : "=r" (value));
+	return value;
+}
+
+void x86_writeCR0(uint32_t value) {
+	asm volatile ("mov %0, %%cr0" : : "r" (value) : "memory");
+}
+
+void x86_writeCR3(uint32_t value) {
+	asm volatile ("mov %0, %%cr3" : : "r" (value) : "memory");
+}
+
+void x86_writeCR4(uint32_t value) {
+	asm volatile ("mov %0, %%cr4" : : "r" (value) : "memory");
+}
+
+// interrupt flag
+
+//clears IF and returns the previous EFLAGS for x86_restoreInterrupts()
+uint32_t x86_disableInterrupts(void) {
+	uint32_t flags;
+	asm volatile ("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+	return flags;
+}
+
+void x86_restoreInterrupts(uint32_t flags) {
+	asm volatile ("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
+void x86_enableInterrupts(void) {
+	asm volatile ("sti" : : : "memory");
+}
+
+//invalidate the TLB entry for one page
+void x86_invlpg(uint32_t address) {
+	asm volatile ("invlpg (%0)" : : "r" (address) : "memory");
+}
+
+//write back and invalidate all caches
+void x86_wbinvd(void) {
+	asm volatile ("wbinvd" : : : "memory");
+}
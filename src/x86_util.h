@@ -10,6 +10,11 @@
 
 #include <stdint.h>
 
+//x86 keeps stores in order, so lock-free queues between an interrupt
+//handler and the main loop only need the compiler kept from moving a data
+//access across the index update
+#define X86_BARRIER() asm volatile ("" : : : "memory")
+
 uint8_t x86_inb(uint16_t port);
 uint16_t x86_inw(uint16_t port);
 uint32_t x86_ind(uint16_t port);
@@ -23,4 +28,29 @@ void x86_readMSR(uint32_t msr, uint32_t *lo, uint32_t *hi);
 //write to model specific register 
 void x86_writeMSR(uint32_t msr, uint32_t lo, uint32_t hi);
 
+//read time stamp counter
+uint64_t x86_rdtsc(void);
+
+//processor identification; regs receives eax, ebx, ecx, edx
+void x86_cpuid(uint32_t leaf, uint32_t regs[4]);
+
+//control registers
+uint32_t x86_readCR0(void);
+uint32_t x86_readCR2(void);
+uint32_t x86_readCR3(void);
+uint32_t x86_readCR4(void);
+void x86_writeCR0(uint32_t value);
+void x86_writeCR3(uint32_t value);
+void x86_writeCR4(uint32_t value);
+
+//clears IF and returns the previous EFLAGS for x86_restoreInterrupts()
+uint32_t x86_disableInterrupts(void);
+void x86_restoreInterrupts(uint32_t flags);
+void x86_enableInterrupts(void);
+
+//invalidate the TLB entry for one page
+void x86_invlpg(uint32_t address);
+//write back and invalidate all caches
+void x86_wbinvd(void);
+
 #endif //X86_UTIL_H